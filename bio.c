@@ -6,7 +6,8 @@
 // a synchronization point for disk blocks used by multiple processes.
 //
 // Interface:
-// * To get a buffer for a particular disk block, call bread.
+// * To get a buffer for a particular disk block, call bread,
+//     or bnew if the old contents don't matter.
 // * After changing buffer data, call bwrite to write it to disk.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
@@ -17,6 +18,9 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// log.c pins buffers it has logged with bpin(), so that they
+// stay cached until the flusher has installed them.
 
 #include "types.h"
 #include "defs.h"
@@ -76,8 +80,8 @@ bget(uint dev, uint blockno)
   }
 
   // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
+  // Buffers that log.c has modified but not yet installed
+  // are pinned, so their refcnt is not zero.
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
     if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
       b->dev = dev;
@@ -105,6 +109,18 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block without
+// reading it, for a caller that will overwrite all of it.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->flags |= B_VALID;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -139,6 +155,22 @@ brelse(struct buf *b)
   
   release(&bcache.lock);
 }
+
+// Keep b in the cache even after brelse(), until bunpin().
+void
+bpin(struct buf *b)
+{
+  acquire(&bcache.lock);
+  b->refcnt++;
+  release(&bcache.lock);
+}
+
+void
+bunpin(struct buf *b)
+{
+  acquire(&bcache.lock);
+  b->refcnt--;
+  release(&bcache.lock);
+}
 //PAGEBREAK!
 // Blank page.
-
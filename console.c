@@ -14,6 +14,8 @@
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "poll.h"
+#include "fcntl.h"
 
 static void consputc(int);
 
@@ -221,6 +223,7 @@ consoleintr(int (*getc)(void))
         if(c == '\n' || c == C('D') || input.e == input.r+INPUT_BUF){
           input.w = input.e;
           wakeup(&input.r);
+          pollwakeup();
         }
       }
       break;
@@ -232,8 +235,10 @@ consoleintr(int (*getc)(void))
   }
 }
 
-int
-consoleread(struct inode *ip, char *dst, int n)
+// If nonblock is set, return what has been typed so far
+// rather than wait, or EAGAIN if that is nothing.
+static int
+consread(struct inode *ip, char *dst, int n, int nonblock)
 {
   uint target;
   int c;
@@ -243,10 +248,12 @@ consoleread(struct inode *ip, char *dst, int n)
   acquire(&cons.lock);
   while(n > 0){
     while(input.r == input.w){
-      if(myproc()->killed){
+      if(myproc()->killed || nonblock){
         release(&cons.lock);
         ilock(ip);
-        return -1;
+        if(!nonblock)
+          return -1;
+        return n < target ? target - n : EAGAIN;
       }
       sleep(&input.r, &cons.lock);
     }
@@ -270,6 +277,18 @@ consoleread(struct inode *ip, char *dst, int n)
   return target - n;
 }
 
+int
+consoleread(struct inode *ip, char *dst, int n)
+{
+  return consread(ip, dst, n, 0);
+}
+
+int
+consoletryread(struct inode *ip, char *dst, int n)
+{
+  return consread(ip, dst, n, 1);
+}
+
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
@@ -285,6 +304,20 @@ consolewrite(struct inode *ip, char *buf, int n)
   return n;
 }
 
+// For poll(): a line can be read once it is complete.
+int
+consolepoll(struct inode *ip)
+{
+  int r;
+
+  acquire(&cons.lock);
+  r = POLLOUT;
+  if(input.r != input.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
@@ -292,6 +325,8 @@ consoleinit(void)
 
   devsw[CONSOLE].write = consolewrite;
   devsw[CONSOLE].read = consoleread;
+  devsw[CONSOLE].poll = consolepoll;
+  devsw[CONSOLE].tryread = consoletryread;
   cons.locking = 1;
 
   ioapicenable(IRQ_KBD, 0);
@@ -0,0 +1,43 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+char buf[512];
+
+int
+main(int argc, char *argv[])
+{
+  int fd0, fd1, n;
+
+  if(argc != 3){
+    printf(2, "Usage: cp src dst\n");
+    exit();
+  }
+  if((fd0 = open(argv[1], O_RDONLY)) < 0){
+    printf(2, "cp: cannot open %s\n", argv[1]);
+    exit();
+  }
+  unlink(argv[2]);  // open() doesn't truncate
+  if((fd1 = open(argv[2], O_CREATE|O_WRONLY)) < 0){
+    printf(2, "cp: cannot create %s\n", argv[2]);
+    exit();
+  }
+
+  // Let the kernel copy; fall back to read/write if it can't.
+  while((n = copy_file_range(fd0, fd1, 64*1024)) > 0)
+    ;
+  if(n < 0){
+    while((n = read(fd0, buf, sizeof(buf))) > 0){
+      if(write(fd1, buf, n) != n){
+        printf(2, "cp: write error\n");
+        exit();
+      }
+    }
+    if(n < 0)
+      printf(2, "cp: read error\n");
+  }
+  close(fd0);
+  close(fd1);
+  exit();
+}
@@ -1,7 +1,11 @@
 struct buf;
 struct context;
 struct file;
+struct files;
 struct inode;
+struct iovec;
+struct logstat;
+struct pcidev;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -9,11 +13,15 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vdso;
 
 // bio.c
 void            binit(void);
+void            bpin(struct buf*);
+struct buf*     bnew(uint, uint);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
+void            bunpin(struct buf*);
 void            bwrite(struct buf*);
 
 // console.c
@@ -29,14 +37,31 @@ int             exec(char*, char**);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
+struct files*   filesalloc(struct inode*);
+struct files*   filescopy(struct files*);
+struct inode*   filescwd(struct files*);
+struct files*   filesdup(struct files*);
+void            filesput(struct files*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filepread(struct file*, char*, int n, uint);
+int             filepwrite(struct file*, char*, int n, uint);
+int             filesplice(struct file*, struct file*, int n, int tee);
+int             filecopy(struct file*, struct file*, int n);
+int             filepoll(struct file*);
+uint            pollgen(void);
+int             pollwait(uint, int);
+void            pollwakeup(void);
+void            polltick(void);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
+void            dcacheforget(struct inode*, char*);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
@@ -84,13 +109,25 @@ void            microdelay(int);
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
+void            log_data(struct buf*);
+void            log_free(uint);
+void            logstat(struct logstat*);
 void            begin_op();
+void            begin_opn(int);
 void            end_op();
+void            end_opn(int);
+int             log_maxop(void);
 
 // mp.c
 extern int      ismp;
 void            mpinit(void);
 
+// pci.c
+uint            pciconfread(struct pcidev*, uint);
+void            pciconfwrite(struct pcidev*, uint, uint);
+int             pcifindclass(uchar, uchar, struct pcidev*);
+int             pcifinddev(ushort, ushort, struct pcidev*);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -98,16 +135,28 @@ void            picinit(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, char*, int);
-int             pipewrite(struct pipe*, char*, int);
+int             piperead(struct pipe*, char*, int, int);
+int             pipewrite(struct pipe*, char*, int, int);
+int             piperesize(struct pipe*, int);
+int             pipesize(struct pipe*);
+int             pipepoll(struct pipe*, int);
+char*           pipewbegin(struct pipe*, int*);
+void            pipewend(struct pipe*, int);
+char*           piperbegin(struct pipe*, int*);
+void            piperend(struct pipe*, int);
 
 //PAGEBREAK: 16
 // proc.c
+int             clone(void(*)(void*, void*), void*, void*, void*);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             futexwait(int*, int);
+int             futexwake(int*, int);
 int             growproc(int);
+int             join(void**);
 int             kill(int);
+int             kthread(char*, void(*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -116,6 +165,7 @@ void            proc_ps(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
+pde_t*          setuvm(pde_t*, uint);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
@@ -157,6 +207,9 @@ int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
 void            syscall(void);
 
+// sysfile.c
+void            argfdput(void);
+
 // timer.c
 void            timerinit(void);
 
@@ -171,6 +224,12 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// virtio.c
+int             virtioinit(void);
+void            virtiointr(void);
+extern int      virtioirq;
+void            virtiorw(struct buf*);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
@@ -186,6 +245,8 @@ void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             mapvdso(pde_t*);
+extern struct vdso *vdso;
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
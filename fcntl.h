@@ -2,3 +2,14 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+#define O_NONBLOCK 0x400  // reads and writes return EAGAIN, not wait
+
+// What read() and write() on an O_NONBLOCK pipe or device
+// return, instead of waiting.
+#define EAGAIN (-2)
+
+// fcntl() commands
+#define F_GETPIPE_SZ 1  // size of a pipe's buffer
+#define F_SETPIPE_SZ 2  // resize a pipe's buffer
+#define F_GETFL      3  // open mode and O_NONBLOCK
+#define F_SETFL      4  // set O_NONBLOCK
@@ -5,21 +5,60 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "mmu.h"
+#include "proc.h"
+#include "uio.h"
+#include "poll.h"
+#include "fcntl.h"
 
 struct devsw devsw[NDEV];
+
+// Unused file structures are kept on a free list, so ftable.lock
+// is only held to take one off or put one back; each file's ref
+// is protected by its own f->lock.  The table starts with NFILE
+// files and grows a page at a time when they are all open.
 struct {
   struct spinlock lock;
+  struct file *free;
   struct file file[NFILE];
 } ftable;
 
+// Initialize f and put it on the free list.
+// Caller holds ftable.lock, or is fileinit().
+static void
+fileadd(struct file *f)
+{
+  initlock(&f->lock, "file");
+  initsleeplock(&f->offlock, "fileoff");
+  f->next = ftable.free;
+  ftable.free = f;
+}
+
+// poll() sleeps until something that might have made a file
+// ready calls pollwakeup(), or, if it has a timeout, until the
+// next tick.  One channel serves every poll(), so a process can
+// wait for many files at once.
+struct {
+  struct spinlock lock;
+  uint gen;    // count of pollwakeup()s
+  int nwait;   // processes sleeping in pollwait()
+  int ntimed;  // how many of them have a timeout
+} pollq;
+
 void
 fileinit(void)
 {
+  struct file *f;
+
   initlock(&ftable.lock, "ftable");
+  initlock(&pollq.lock, "poll");
+  for(f = ftable.file; f < ftable.file + NFILE; f++)
+    fileadd(f);
 }
 
 // Allocate a file structure.
@@ -27,28 +66,31 @@ struct file*
 filealloc(void)
 {
   struct file *f;
+  char *p;
 
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  if(ftable.free == 0 && (p = kalloc()) != 0){
+    memset(p, 0, PGSIZE);
+    for(f = (struct file*)p; f + 1 <= (struct file*)(p + PGSIZE); f++)
+      fileadd(f);
+  }
+  if((f = ftable.free) != 0){
+    ftable.free = f->next;
+    f->ref = 1;
   }
   release(&ftable.lock);
-  return 0;
+  return f;
 }
 
 // Increment ref count for file f.
 struct file*
 filedup(struct file *f)
 {
-  acquire(&ftable.lock);
+  acquire(&f->lock);
   if(f->ref < 1)
     panic("filedup");
   f->ref++;
-  release(&ftable.lock);
+  release(&f->lock);
   return f;
 }
 
@@ -58,16 +100,20 @@ fileclose(struct file *f)
 {
   struct file ff;
 
-  acquire(&ftable.lock);
+  acquire(&f->lock);
   if(f->ref < 1)
     panic("fileclose");
   if(--f->ref > 0){
-    release(&ftable.lock);
+    release(&f->lock);
     return;
   }
   ff = *f;
-  f->ref = 0;
   f->type = FD_NONE;
+  release(&f->lock);
+
+  acquire(&ftable.lock);
+  f->next = ftable.free;
+  ftable.free = f;
   release(&ftable.lock);
 
   if(ff.type == FD_PIPE)
@@ -79,6 +125,83 @@ fileclose(struct file *f)
   }
 }
 
+// Allocate a struct files with one reference, no open
+// files, and directory cwd, taking over the caller's reference.
+struct files*
+filesalloc(struct inode *cwd)
+{
+  struct files *fs;
+
+  if((fs = (struct files*)kalloc()) == 0)
+    return 0;
+  memset(fs, 0, sizeof(*fs));
+  initlock(&fs->lock, "files");
+  fs->ref = 1;
+  fs->cwd = cwd;
+  return fs;
+}
+
+// Copy fs for fork(): the same open files and directory.
+struct files*
+filescopy(struct files *fs)
+{
+  struct files *nfs;
+  int fd;
+
+  if((nfs = filesalloc(0)) == 0)
+    return 0;
+  acquire(&fs->lock);
+  for(fd = 0; fd < NOFILE; fd++)
+    if(fs->ofile[fd])
+      nfs->ofile[fd] = filedup(fs->ofile[fd]);
+  nfs->cwd = idup(fs->cwd);
+  release(&fs->lock);
+  return nfs;
+}
+
+// Share fs with one more process, for clone().
+struct files*
+filesdup(struct files *fs)
+{
+  acquire(&fs->lock);
+  fs->ref++;
+  release(&fs->lock);
+  return fs;
+}
+
+// Drop a process's reference to fs.  The last one
+// closes the files and releases the directory.
+void
+filesput(struct files *fs)
+{
+  int fd, r;
+
+  acquire(&fs->lock);
+  r = --fs->ref;
+  release(&fs->lock);
+  if(r > 0)
+    return;
+  for(fd = 0; fd < NOFILE; fd++)
+    if(fs->ofile[fd])
+      fileclose(fs->ofile[fd]);
+  begin_op();
+  iput(fs->cwd);
+  end_op();
+  kfree((char*)fs);
+}
+
+// Return a new reference to fs's current directory.
+struct inode*
+filescwd(struct files *fs)
+{
+  struct inode *ip;
+
+  acquire(&fs->lock);
+  ip = idup(fs->cwd);
+  release(&fs->lock);
+  return ip;
+}
+
 // Get metadata about file f.
 int
 filestat(struct file *f, struct stat *st)
@@ -92,6 +215,116 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Return which of POLLIN, POLLOUT and POLLHUP apply to f.
+// Files are always ready; pipes and devices say for themselves.
+int
+filepoll(struct file *f)
+{
+  int r;
+
+  if(f->type == FD_PIPE)
+    r = pipepoll(f->pipe, f->writable);
+  else if(f->type == FD_INODE && f->ip->type == T_DEV &&
+          f->ip->major >= 0 && f->ip->major < NDEV &&
+          devsw[f->ip->major].poll)
+    r = devsw[f->ip->major].poll(f->ip);
+  else
+    r = POLLIN | POLLOUT;
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r;
+}
+
+// Return the current pollwakeup() count, to pass to pollwait()
+// after checking the files.
+uint
+pollgen(void)
+{
+  uint gen;
+
+  acquire(&pollq.lock);
+  gen = pollq.gen;
+  release(&pollq.lock);
+  return gen;
+}
+
+// Sleep until pollwakeup() has been called since pollgen()
+// returned gen, or until the next tick if timed is set.
+// Returns -1 if the process has been killed.
+int
+pollwait(uint gen, int timed)
+{
+  acquire(&pollq.lock);
+  pollq.nwait++;
+  pollq.ntimed += timed;
+  while(pollq.gen == gen && !myproc()->killed)
+    sleep(&pollq.gen, &pollq.lock);
+  pollq.nwait--;
+  pollq.ntimed -= timed;
+  release(&pollq.lock);
+  return myproc()->killed ? -1 : 0;
+}
+
+// Something may have become ready: wake up poll().
+void
+pollwakeup(void)
+{
+  acquire(&pollq.lock);
+  pollq.gen++;
+  if(pollq.nwait)
+    wakeup(&pollq.gen);
+  release(&pollq.lock);
+}
+
+// Called every tick, to let poll()s with a timeout check the time.
+void
+polltick(void)
+{
+  acquire(&pollq.lock);
+  if(pollq.ntimed){
+    pollq.gen++;
+    wakeup(&pollq.gen);
+  }
+  release(&pollq.lock);
+}
+
+// Devices have no offset to protect, and a console read waits
+// for a whole line, so only other inodes take f->offlock.
+// The inode's type was set when f was opened.
+static void
+lockoff(struct file *f)
+{
+  if(f->ip->type != T_DEV)
+    acquiresleep(&f->offlock);
+}
+
+static void
+unlockoff(struct file *f)
+{
+  if(f->ip->type != T_DEV)
+    releasesleep(&f->offlock);
+}
+
+// Read from device file f without waiting.  The device checks
+// for input and reads it under one lock, so nothing can take
+// the input in between.  Returns EAGAIN if there is none.
+static int
+devtryread(struct file *f, char *addr, int n)
+{
+  int r;
+
+  ilock(f->ip);
+  if(f->ip->major < 0 || f->ip->major >= NDEV ||
+     !devsw[f->ip->major].tryread)
+    r = -1;
+  else
+    r = devsw[f->ip->major].tryread(f->ip, addr, n);
+  iunlock(f->ip);
+  return r;
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
@@ -101,57 +334,361 @@ fileread(struct file *f, char *addr, int n)
   if(f->readable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
+    return piperead(f->pipe, addr, n, f->nonblock);
   if(f->type == FD_INODE){
+    if(f->nonblock && f->ip->type == T_DEV)
+      return devtryread(f, addr, n);
+    lockoff(f);
     ilock(f->ip);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
+    unlockoff(f);
     return r;
   }
   panic("fileread");
 }
 
+// Read from file f into the cnt segments of iov, stopping
+// at the first one that isn't filled.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
+
+  if(f->readable == 0)
+    return -1;
+  tot = r = 0;
+  if(f->type == FD_PIPE){
+    // Don't wait for more data once some has been read.
+    for(i = 0; i < cnt && tot == 0; i++){
+      if((r = piperead(f->pipe, iov[i].base, iov[i].len, f->nonblock)) < 0)
+        return r;
+      tot += r;
+    }
+    return tot;
+  }
+  if(f->type == FD_INODE){
+    if(f->nonblock && f->ip->type == T_DEV){
+      for(i = 0; i < cnt; i++){
+        if((r = devtryread(f, iov[i].base, iov[i].len)) < 0)
+          return tot > 0 ? tot : r;
+        tot += r;
+        if(r != iov[i].len)
+          break;
+      }
+      return tot;
+    }
+    lockoff(f);
+    ilock(f->ip);
+    for(i = 0; i < cnt; i++){
+      if((r = readi(f->ip, iov[i].base, f->off, iov[i].len)) > 0){
+        f->off += r;
+        tot += r;
+      }
+      if(r != iov[i].len)
+        break;
+    }
+    iunlock(f->ip);
+    unlockoff(f);
+    return tot == 0 && r < 0 ? -1 : tot;
+  }
+  panic("filereadv");
+}
+
+// Read from file f at offset off, leaving f->off alone.
+int
+filepread(struct file *f, char *addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  r = readi(f->ip, addr, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
 //PAGEBREAK!
+// Log blocks to reserve for a transaction that writes n bytes
+// to an inode: two per data block, for the bitmap or indirect
+// block it may dirty, plus the i-node, an indirect block, and
+// 2 blocks of slop for non-aligned writes.  Never less than
+// begin_op() reserves, nor more than one op may.
+static int
+writelog(int n)
+{
+  int nlog;
+
+  nlog = 2*((n + BSIZE-1) / BSIZE) + 1+1+2;
+  if(nlog < MAXOPBLOCKS)
+    nlog = MAXOPBLOCKS;
+  if(nlog > log_maxop())
+    nlog = log_maxop();
+  return nlog;
+}
+
+// Write the cnt segments of iov to inode file f at *off,
+// advancing *off.  Returns the number of bytes written.
+static int
+writeiov(struct file *f, struct iovec *iov, int cnt, uint *off)
+{
+  int i, j, done, m, n, n1, nlog, r, tot;
+
+  // write as many blocks at a time as one transaction
+  // may reserve, but reserve only what this chunk needs,
+  // so that small writes leave the log to other FS calls.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  // with the default log a chunk is at most 27 blocks,
+  // about 13.8KB.
+  int max = ((log_maxop()-1-1-2) / 2) * BSIZE;
+
+  i = done = tot = 0;
+  r = n1 = 0;
+  while(1){
+    while(i < cnt && done == iov[i].len){
+      i++;
+      done = 0;
+    }
+    if(i == cnt)
+      break;
+    // This chunk: what is left of iov, up to max.
+    n = iov[i].len - done;
+    for(j = i+1; j < cnt && n < max; j++)
+      n += iov[j].len < max ? iov[j].len : max;
+    if(n > max)
+      n = max;
+    nlog = writelog(n);
+    begin_opn(nlog);
+    ilock(f->ip);
+    // Fill the transaction, crossing segments as needed.
+    for(m = 0; i < cnt && m < n; ){
+      n1 = iov[i].len - done;
+      if(n1 > n - m)
+        n1 = n - m;
+      if((r = writei(f->ip, (char*)iov[i].base + done, *off, n1)) > 0){
+        *off += r;
+        m += r;
+        done += r;
+        tot += r;
+      }
+      if(r != n1)
+        break;  // error, or file is full
+      if(done == iov[i].len){
+        i++;
+        done = 0;
+      }
+    }
+    iunlock(f->ip);
+    end_opn(nlog);
+    if(r != n1)
+      break;
+  }
+  return tot;
+}
+
 // Write to file f.
 int
 filewrite(struct file *f, char *addr, int n)
 {
+  struct iovec iov;
   int r;
 
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
+    return pipewrite(f->pipe, addr, n, f->nonblock);
   if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
+    iov.base = addr;
+    iov.len = n;
+    // Hold offlock throughout, so that the chunks of two writes
+    // through the same file don't interleave.
+    lockoff(f);
+    r = writeiov(f, &iov, 1, &f->off);
+    unlockoff(f);
+    return r == n ? n : -1;
+  }
+  panic("filewrite");
+}
 
-      if(r < 0)
-        break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
+// Write the cnt segments of iov to file f.  A file gets
+// them in as few transactions as the log allows.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
+
+  if(f->writable == 0)
+    return -1;
+  if(f->type == FD_PIPE){
+    for(i = tot = 0; i < cnt; i++){
+      if((r = pipewrite(f->pipe, iov[i].base, iov[i].len, f->nonblock)) < 0)
+        return tot > 0 ? tot : r;
+      tot += r;
+      if(r < iov[i].len)
+        break;  // non-blocking and full
     }
-    return i == n ? n : -1;
+    return tot;
   }
-  panic("filewrite");
+  if(f->type == FD_INODE){
+    for(i = tot = 0; i < cnt; i++)
+      tot += iov[i].len;
+    lockoff(f);
+    r = writeiov(f, iov, cnt, &f->off);
+    unlockoff(f);
+    return r == tot ? tot : -1;
+  }
+  panic("filewritev");
+}
+
+// Write to file f at offset off, leaving f->off alone.
+int
+filepwrite(struct file *f, char *addr, int n, uint off)
+{
+  struct iovec iov;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  iov.base = addr;
+  iov.len = n;
+  return writeiov(f, &iov, 1, &off) == n ? n : -1;
+}
+
+
+// Move up to n bytes from file in to file out without copying
+// them through user memory: from a file or device to a pipe,
+// from a pipe to a file or device, or between two pipes.
+// With tee set, copy between two pipes without consuming.
+// Moves one run of the pipe's ring, so may return less than n.
+int
+filesplice(struct file *in, struct file *out, int n, int tee)
+{
+  char *a, *b;
+  int r;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(tee && (in->type != FD_PIPE || out->type != FD_PIPE))
+    return -1;
+
+  if(in->type == FD_PIPE && out->type == FD_PIPE){
+    if(in->pipe == out->pipe)
+      return -1;
+    // Take the two pipes in address order, so that splices
+    // in opposite directions can't each hold what the other
+    // is waiting for.
+    r = n;
+    b = 0;
+    if(out->pipe < in->pipe && (b = pipewbegin(out->pipe, &r)) == 0)
+      return -1;
+    if((a = piperbegin(in->pipe, &n)) == 0){
+      if(b)
+        pipewend(out->pipe, 0);
+      return -1;
+    }
+    if(n == 0)
+      r = 0;
+    else if(b == 0 && (b = pipewbegin(out->pipe, &r)) == 0)
+      r = -1;
+    else {
+      if(r > n)
+        r = n;
+      memmove(b, a, r);
+    }
+    if(b)
+      pipewend(out->pipe, r < 0 ? 0 : r);
+    piperend(in->pipe, tee || r < 0 ? 0 : r);
+    return r;
+  }
+
+  if(in->type == FD_PIPE && out->type == FD_INODE){
+    if((a = piperbegin(in->pipe, &n)) == 0)
+      return -1;
+    r = n > 0 ? filewrite(out, a, n) : 0;
+    piperend(in->pipe, r < 0 ? 0 : r);
+    return r;
+  }
+
+  if(in->type == FD_INODE && out->type == FD_PIPE){
+    if((b = pipewbegin(out->pipe, &n)) == 0)
+      return -1;
+    r = fileread(in, b, n);
+    pipewend(out->pipe, r < 0 ? 0 : r);
+    return r;
+  }
+
+  return -1;
 }
 
+// Copy up to n bytes from file in to file out inside the kernel,
+// each at its own offset.  The data goes through one kernel page,
+// and as much of it as the log allows is written in one
+// transaction.  If either file is a pipe, this is filesplice().
+// Returns the number of bytes copied, or -1.
+int
+filecopy(struct file *in, struct file *out, int n)
+{
+  char *buf;
+  int c, nlog, max, tot, m, r, w;
+
+  if(in->type == FD_PIPE || out->type == FD_PIPE)
+    return filesplice(in, out, n, 0);
+  if(in->readable == 0 || out->writable == 0 || n < 0 || in == out)
+    return -1;
+  // A transaction must not wait for a device to produce data.
+  ilock(in->ip);
+  r = in->ip->type;
+  iunlock(in->ip);
+  if(r == T_DEV)
+    return -1;
+  if((buf = kalloc()) == 0)
+    return -1;
+
+  max = ((log_maxop()-1-1-2) / 2) * BSIZE;
+  // Lock the offsets in address order, so that copies running
+  // in opposite directions between two files can't deadlock.
+  lockoff(in < out ? in : out);
+  lockoff(in < out ? out : in);
+  r = w = 0;
+  for(tot = 0; tot < n; ){
+    c = n - tot < max ? n - tot : max;
+    nlog = writelog(c);
+    begin_opn(nlog);
+    for(m = 0; m < c; m += w, tot += w){
+      r = c - m;
+      if(r > PGSIZE)
+        r = PGSIZE;
+      ilock(in->ip);
+      r = readi(in->ip, buf, in->off, r);
+      iunlock(in->ip);
+      if(r <= 0)
+        break;
+      ilock(out->ip);
+      w = writei(out->ip, buf, out->off, r);
+      iunlock(out->ip);
+      // Advance both offsets by what was written, so that
+      // a short write (the disk is full) loses no input.
+      if(w > 0){
+        in->off += w;
+        out->off += w;
+      }
+      if(w != r){
+        if(w > 0)
+          tot += w;
+        break;
+      }
+    }
+    end_opn(nlog);
+    if(r <= 0 || w != r)
+      break;
+  }
+  unlockoff(out);
+  unlockoff(in);
+  kfree(buf);
+  // An error is reported only if nothing was copied.
+  if(tot == 0 && (r < 0 || w != r))
+    return -1;
+  return tot;
+}
@@ -3,9 +3,22 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;  // O_NONBLOCK
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  struct spinlock lock;     // protects ref
+  struct sleeplock offlock; // held by a read or write using off
+  struct file *next;        // ftable free list
+};
+
+// A process's open files and current directory.  fork() gives
+// the child a copy; clone() threads share their creator's.
+struct files {
+  struct spinlock lock;        // protects everything below
+  int ref;                     // processes sharing these
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
 };
 
 
@@ -14,6 +27,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;  // icache hash chain
+  struct inode *lprev;  // icache LRU list, if ref is 0
+  struct inode *lnext;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -22,7 +38,19 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint index;
+  uint addrs[NADDRS];
+
+  uint lastblock;     // block last allocated to the inode, or 0
+  uint pstart;        // run of plen blocks preallocated for
+  uint plen;          //   writei(), starting at pstart
+  uint pwant;         // blocks writei() has yet to allocate
+  uint iblock;        // indirect block last used by bmap(), or 0
+  uint ibase;         // file block mapped by iblock's first entry
+
+  uint elbn;          // last extent used by bmap() (FS_EXTENTS):
+  uint elen;          //   first file block, length
+  uint estart;        //   and first disk block
 };
 
 // table mapping major device number to
@@ -30,6 +58,8 @@ struct inode {
 struct devsw {
   int (*read)(struct inode*, char*, int);
   int (*write)(struct inode*, char*, int);
+  int (*poll)(struct inode*);  // POLLIN/POLLOUT if ready, or 0
+  int (*tryread)(struct inode*, char*, int);  // EAGAIN, not wait
 };
 
 extern struct devsw devsw[];
@@ -44,7 +44,7 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = bnew(dev, bno);
   memset(bp->data, 0, BSIZE);
   log_write(bp);
   brelse(bp);
@@ -52,32 +52,73 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Next-fit cursor: balloc() without a hint starts where the
+// last allocation left off.  Like sb, one device only.
+static uint bcursor;
+
+// Allocate a run of up to *len disk blocks, not zeroed: the
+// first free block at or after hint, wrapping around at the end
+// of the disk, and as many free blocks after it as the same
+// bitmap block shows.  Sets *len to the length of the run.
+// A hint of 0 means "after the last block allocated".
+// The bitmap is scanned a 32-bit word at a time.
 static uint
-balloc(uint dev)
+ballocn(uint dev, uint hint, uint *len)
 {
-  int b, bi, m;
+  uint n, nw, wi, w, bi, b, i;
   struct buf *bp;
 
+  if(hint == 0 || hint >= sb.size)
+    hint = bcursor;
+  nw = (sb.size + 31) / 32;
+  wi = hint / 32;
   bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
+  for(n = 0; n <= nw; n++, wi = (wi + 1) % nw){
+    if(bp == 0 || bp->blockno != BBLOCK(wi*32, sb)){
+      if(bp)
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      bp = bread(dev, BBLOCK(wi*32, sb));
+    }
+    w = ((uint*)bp->data)[wi % (BPB/32)];
+    if(n == 0)
+      w |= (1 << (hint % 32)) - 1;  // start at hint
+    if(w == 0xffffffff)
+      continue;
+    for(bi = 0; w & (1 << bi); bi++)
+      ;
+    b = wi*32 + bi;
+    if(b >= sb.size)
+      continue;
+    for(i = 1; i < *len && b+i < sb.size && (b+i) % BPB != 0; i++){
+      if(bp->data[(b+i)%BPB/8] & (1 << ((b+i) % 8)))
+        break;
     }
+    *len = i;
+    for(i = b; i < b + *len; i++)
+      bp->data[i%BPB/8] |= 1 << (i % 8);  // Mark block in use.
+    log_write(bp);
     brelse(bp);
+    bcursor = b + *len;
+    return b;
   }
   panic("balloc: out of blocks");
 }
 
-// Free a disk block.
+// Allocate a disk block at or after hint, zeroed if zero is set.
+static uint
+balloc(uint dev, uint hint, int zero)
+{
+  uint b, len;
+
+  len = 1;
+  b = ballocn(dev, hint, &len);
+  if(zero)
+    bzero(dev, b);
+  return b;
+}
+
+// Free a disk block.  Called directly only for blocks this
+// transaction allocated and never used; see mfree().
 static void
 bfree(int dev, uint b)
 {
@@ -94,6 +135,17 @@ bfree(int dev, uint b)
   brelse(bp);
 }
 
+// Free block b of a file or directory.  On disk, b belongs to
+// its old owner until the transaction freeing it commits, so
+// the log must not let another file's data overwrite it in
+// place before then, whether b held data or metadata.
+static void
+mfree(int dev, uint b)
+{
+  log_free(b);
+  bfree(dev, b);
+}
+
 // Inodes.
 //
 // An inode describes a single unnamed file.
@@ -119,18 +171,19 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() finds or creates a cache
+//   entry and increments its ref; iput() decrements ref.
+//   An entry whose ref is zero may be recycled for another
+//   inode, but until then it stays in the cache, so that
+//   using the inode again doesn't have to re-read it.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -157,26 +210,60 @@ bfree(int dev, uint b)
 // The icache.lock spin-lock protects the allocation of icache
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// holds, one must hold icache.lock while using any of those fields,
+// or the hash chain and LRU links.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// Entries live on a hash table keyed by (dev, inum).  Those with
+// ref zero are also on an LRU list, which iget() recycles from
+// once the cache holds NINODE entries; until then, and whenever
+// every entry is in use, it allocates a page of new ones.
+
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode *lruhead;  // unreferenced, least recently used first
+  struct inode *lrutail;
+  int n;                  // number of entries
 } icache;
 
+// Directory entry cache: remembers what namex() found when it
+// looked up name in directory (dev, dinum), so repeating the
+// lookup needs neither the directory's lock nor its blocks.
+// inum 0 records that name was not there.  dirlink() and
+// sys_unlink() forget entries for the names they change, and
+// freeing an inode forgets entries in or for it.
+//
+// gen counts the changes, so namex() can tell whether one
+// happened after it looked in the directory and before it added
+// the result, which is then stale.
+struct dentry {
+  uint dev;
+  uint dinum;      // directory, or 0 if the entry is free
+  char name[DIRSIZ];
+  uint inum;       // 0: not in the directory
+  short type;      // inum's type
+  uint used;       // dcache.clock at last use
+};
+
+struct {
+  struct spinlock lock;
+  uint gen;
+  uint clock;
+  struct dentry dentry[NDENTRY];
+} dcache;
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  initlock(&dcache.lock, "dcache");
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
@@ -186,19 +273,26 @@ iinit(int dev)
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void dcachepurge(struct inode*);
 
 //PAGEBREAK!
+// Next-fit cursor for ialloc(): the inode allocated last.
+static uint icursor;
+
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode.
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  int n, inum;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
+  for(n = 1; n <= sb.ninodes; n++){
+    inum = (icursor + n) % sb.ninodes;
+    if(inum == 0)
+      continue;
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
@@ -206,6 +300,7 @@ ialloc(uint dev, short type)
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
+      icursor = inum;
       return iget(dev, inum);
     }
     brelse(bp);
@@ -221,51 +316,122 @@ void
 iupdate(struct inode *ip)
 {
   struct buf *bp;
-  struct dinode *dip;
+  struct dinode *dip, di;
+
+  memset(&di, 0, sizeof(di));
+  di.type = ip->type;
+  di.major = ip->major;
+  di.minor = ip->minor;
+  di.nlink = ip->nlink;
+  di.size = ip->size;
+  di.index = ip->index;
+  memmove(di.addrs, ip->addrs, sizeof(ip->addrs));
 
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
-  dip->type = ip->type;
-  dip->major = ip->major;
-  dip->minor = ip->minor;
-  dip->nlink = ip->nlink;
-  dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
-  log_write(bp);
+  // Don't log the inode block if nothing changed.
+  if(memcmp(dip, &di, sizeof(di)) != 0){
+    *dip = di;
+    log_write(bp);
+  }
   brelse(bp);
 }
 
+// LRU list of unreferenced entries.  Caller holds icache.lock.
+static void
+lruremove(struct inode *ip)
+{
+  if(ip->lprev)
+    ip->lprev->lnext = ip->lnext;
+  else
+    icache.lruhead = ip->lnext;
+  if(ip->lnext)
+    ip->lnext->lprev = ip->lprev;
+  else
+    icache.lrutail = ip->lprev;
+  ip->lprev = ip->lnext = 0;
+}
+
+// Add ip to the LRU list: at the tail if it's worth keeping,
+// else at the head, to be recycled first.
+static void
+lruadd(struct inode *ip, int keep)
+{
+  if(keep){
+    ip->lprev = icache.lrutail;
+    ip->lnext = 0;
+    if(icache.lrutail)
+      icache.lrutail->lnext = ip;
+    else
+      icache.lruhead = ip;
+    icache.lrutail = ip;
+  } else {
+    ip->lprev = 0;
+    ip->lnext = icache.lruhead;
+    if(icache.lruhead)
+      icache.lruhead->lprev = ip;
+    else
+      icache.lrutail = ip;
+    icache.lruhead = ip;
+  }
+}
+
+// Add a page of new, unused entries to the cache.
+// Caller holds icache.lock.
+static void
+igrow(void)
+{
+  char *p;
+  struct inode *ip;
+
+  if((p = kalloc()) == 0)
+    return;
+  memset(p, 0, PGSIZE);
+  for(ip = (struct inode*)p; ip + 1 <= (struct inode*)(p + PGSIZE); ip++){
+    initsleeplock(&ip->lock, "inode");
+    lruadd(ip, 0);
+    icache.n++;
+  }
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Recycle the least recently used inode cache entry.
+  if(icache.n < NINODE || icache.lruhead == 0)
+    igrow();
+  if((ip = icache.lruhead) == 0)
     panic("iget: no inodes");
+  lruremove(ip);
+  if(ip->inum != 0){
+    for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = icache.hash[IHASH(dev, inum)];
+  icache.hash[IHASH(dev, inum)] = ip;
   release(&icache.lock);
 
   return ip;
@@ -303,8 +469,12 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
+    ip->index = dip->index;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->elen = 0;
+    ip->iblock = 0;
+    ip->lastblock = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -323,7 +493,7 @@ iunlock(struct inode *ip)
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
-// be recycled.
+// be recycled, but stays cached until it is.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -338,6 +508,7 @@ iput(struct inode *ip)
     release(&icache.lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      dcachepurge(ip);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
@@ -347,7 +518,8 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0)
+    lruadd(ip, ip->valid);
   release(&icache.lock);
 }
 
@@ -365,38 +537,239 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT].  ip->addrs[NDIRECT+1]
+// is a doubly-indirect block for the next NDINDIRECT blocks,
+// and ip->addrs[NDIRECT+2] a triply-indirect block for the
+// NTINDIRECT after that.
+//
+// bmap() remembers the last leaf indirect block it used, so
+// sequential access walks the tree only once per leaf.
+//
+// On an FS_EXTENTS file system, ip->addrs[] holds extents
+// instead (see fs.h), so a file written sequentially is mapped
+// by a few (start, len) runs.  Files are never sparse: writei()
+// only appends at the end, so a block past the last extent is
+// always the next one in the file.
+//
+// writei() tells bmap() how many blocks a write will add
+// (ip->pwant), so that they are allocated as one run where the
+// bitmap allows.  The new data blocks of a regular file are not
+// zeroed: writei() fills each one as soon as it is allocated,
+// zeroing the rest itself, and nothing reads a file past its end.
+//
+// On an FS_ORDERED file system, writei() writes the data of
+// regular files straight to disk instead of logging it.
+#define ORDERED(ip) ((sb.flags & FS_ORDERED) && (ip)->type == T_FILE)
+
+static uint iballoc(struct inode*, uint, int);
+
+// Return the disk block address of the nth block in extent
+// inode ip, appending a block if bn is just past the end.
+// Returns 0 if the file has no room for another extent.
+static uint
+ebmap(struct inode *ip, uint bn)
+{
+  struct extent *e, *last;
+  struct buf *bp;
+  uint lbn, addr;
+  int i;
+
+  // Sequential access stays within one extent.
+  if(bn >= ip->elbn && bn < ip->elbn + ip->elen)
+    return ip->estart + (bn - ip->elbn);
+
+  bp = 0;
+  e = last = 0;
+  lbn = 0;
+  for(i = 0; i < NEXTENT + NEXTBLK; i++){
+    if(i < NEXTENT)
+      e = (struct extent*)ip->addrs + i;
+    else if(ip->addrs[EXTBLOCK] == 0){
+      e = 0;  // extent block not allocated yet
+      break;
+    } else {
+      if(bp == 0)
+        bp = bread(ip->dev, ip->addrs[EXTBLOCK]);
+      e = (struct extent*)bp->data + (i - NEXTENT);
+    }
+    if(e->len == 0)
+      break;
+    if(bn < lbn + e->len){
+      ip->elbn = lbn;
+      ip->elen = e->len;
+      ip->estart = e->start;
+      if(bp)
+        brelse(bp);
+      return e->start + (bn - lbn);
+    }
+    lbn += e->len;
+    last = e;
+  }
+  if(bn != lbn)
+    panic("ebmap: hole");
+
+  // Append: allocate as close as possible after the last
+  // extent, and grow it if the new block is adjacent.
+  addr = iballoc(ip, last ? last->start + last->len : 0, 1);
+  if(last && addr == last->start + last->len){
+    last->len++;
+  } else if(i == NEXTENT + NEXTBLK){
+    bfree(ip->dev, addr);
+    addr = 0;  // out of extents
+  } else {
+    if(e == 0){
+      // Use the new block for the extent block, so that
+      // the new extent can grow from the one after it.
+      ip->addrs[EXTBLOCK] = addr;
+      if(ip->type == T_FILE)
+        bzero(ip->dev, addr);  // allocated as data, not zeroed
+      addr = iballoc(ip, addr + 1, 1);
+      bp = bread(ip->dev, ip->addrs[EXTBLOCK]);
+      e = (struct extent*)bp->data;
+    }
+    e->start = addr;
+    e->len = 1;
+  }
+  // The inode's own extents reach disk through iupdate().
+  if(bp){
+    if(addr)
+      log_write(bp);
+    brelse(bp);
+  }
+  return addr;
+}
+
+// Allocate a block for ip, at or after hint.  The block
+// comes from the run preallocated for writei(), which is
+// allocated here if writei() still wants more than one block.
+// data says whether it will hold file data or metadata.
+static uint
+iballoc(struct inode *ip, uint hint, int data)
+{
+  uint b;
+
+  if(ip->plen == 0 && ip->pwant > 1){
+    ip->plen = ip->pwant;
+    ip->pstart = ballocn(ip->dev, hint, &ip->plen);
+  }
+  if(ip->plen > 0){
+    b = ip->pstart++;
+    ip->plen--;
+  } else
+    b = balloc(ip->dev, hint, 0);
+  if(ip->pwant > 0)
+    ip->pwant--;
+  if(!data || ip->type != T_FILE)
+    bzero(ip->dev, b);
+  ip->lastblock = b;
+  return b;
+}
+
+// Allocate a block for ip in the indirect tree, preferably just
+// after the last one it was given, to keep its blocks together.
+static uint
+itballoc(struct inode *ip, int data)
+{
+  return iballoc(ip, ip->lastblock ? ip->lastblock + 1 : 0, data);
+}
+
+// Return entry i of indirect block addr, allocating
+// a block for it if there is none.
+static uint
+ientry(struct inode *ip, uint addr, uint i, int data)
+{
+  uint *a;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    a[i] = addr = itballoc(ip, data);
+    log_write(bp);
+  }
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, fbn, div, *root;
+
+  if(sb.flags & FS_EXTENTS)
+    return ebmap(ip, bn);
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = itballoc(ip, 1);
     return addr;
   }
-  bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+  fbn = bn;
+  if(ip->iblock == 0 || fbn < ip->ibase || fbn >= ip->ibase + NINDIRECT){
+    // Find the indirect block mapping fbn: root is the
+    // inode's pointer to the top of its tree, and div the
+    // number of blocks each entry of that top block covers.
+    bn -= NDIRECT;
+    if(bn < NINDIRECT){
+      root = &ip->addrs[NDIRECT];
+      div = 1;
+    } else if((bn -= NINDIRECT) < NDINDIRECT){
+      root = &ip->addrs[NDIRECT+1];
+      div = NINDIRECT;
+    } else if((bn -= NDINDIRECT) < NTINDIRECT){
+      root = &ip->addrs[NDIRECT+2];
+      div = NDINDIRECT;
+    } else
+      panic("bmap: out of range");
+
+    // Load it, allocating the blocks on the way if necessary.
+    if((addr = *root) == 0)
+      *root = addr = itballoc(ip, 0);
+    for(; div > 1; div /= NINDIRECT)
+      addr = ientry(ip, addr, bn / div % NINDIRECT, 0);
+    ip->iblock = addr;
+    ip->ibase = fbn - bn % NINDIRECT;
   }
 
-  panic("bmap: out of range");
+  // The indirect block itself stays in the buffer cache.
+  return ientry(ip, ip->iblock, fbn - ip->ibase, 1);
+}
+
+// Free indirect block addr and the blocks it lists,
+// which are indirect blocks themselves if level > 1.
+static void
+ifree(uint dev, uint addr, int level)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 1)
+      ifree(dev, a[j], level-1);
+    else
+      mfree(dev, a[j]);
+  }
+  brelse(bp);
+  mfree(dev, addr);
+}
+
+// Free the blocks of extent e.
+static void
+efree(uint dev, struct extent *e)
+{
+  uint b;
+
+  for(b = 0; b < e->len; b++)
+    mfree(dev, e->start + b);
+  e->start = e->len = 0;
 }
 
 // Truncate inode (discard contents).
@@ -409,26 +782,45 @@ itrunc(struct inode *ip)
 {
   int i, j;
   struct buf *bp;
-  uint *a;
+
+  if(ip->index){
+    mfree(ip->dev, ip->index);
+    ip->index = 0;
+  }
+
+  if(sb.flags & FS_EXTENTS){
+    for(i = 0; i < NEXTENT; i++)
+      efree(ip->dev, (struct extent*)ip->addrs + i);
+    if(ip->addrs[EXTBLOCK]){
+      bp = bread(ip->dev, ip->addrs[EXTBLOCK]);
+      for(j = 0; j < NEXTBLK; j++)
+        efree(ip->dev, (struct extent*)bp->data + j);
+      brelse(bp);
+      mfree(ip->dev, ip->addrs[EXTBLOCK]);
+      ip->addrs[EXTBLOCK] = 0;
+    }
+    ip->elen = 0;
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
+      mfree(ip->dev, ip->addrs[i]);
       ip->addrs[i] = 0;
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  // Single, double and triple indirect trees.
+  for(i = 0; i < 3; i++){
+    if(ip->addrs[NDIRECT+i]){
+      ifree(ip->dev, ip->addrs[NDIRECT+i], i+1);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  ip->iblock = 0;
+  ip->lastblock = 0;
 
   ip->size = 0;
   iupdate(ip);
@@ -481,7 +873,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, nb;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -492,22 +884,44 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(!(sb.flags & FS_EXTENTS) && off + n > MAXFILE*BSIZE)
     return -1;
 
+  // Blocks from nb on are new; have bmap() allocate them together.
+  nb = (ip->size + BSIZE - 1) / BSIZE;
+  if(off + n > nb*BSIZE)
+    ip->pwant = (off + n - nb*BSIZE + BSIZE - 1) / BSIZE;
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if((addr = bmap(ip, off/BSIZE)) == 0)
+      break;  // extent file is full
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(off/BSIZE >= nb && ip->type == T_FILE){
+      // New and not zeroed: no need to read it.
+      bp = bnew(ip->dev, addr);
+      memset(bp->data + m, 0, BSIZE - m);
+    } else
+      bp = bread(ip->dev, addr);
     memmove(bp->data + off%BSIZE, src, m);
-    log_write(bp);
+    if(ORDERED(ip))
+      log_data(bp);
+    else
+      log_write(bp);
     brelse(bp);
   }
 
-  if(n > 0 && off > ip->size){
+  // Give back any of the run the write didn't use.
+  for(; ip->plen > 0; ip->plen--)
+    bfree(ip->dev, ip->pstart++);
+  ip->pwant = 0;
+
+  if(tot > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
   }
-  return n;
+  if(tot == 0 && n > 0)
+    return -1;
+  return tot;
 }
 
 //PAGEBREAK!
@@ -521,6 +935,10 @@ namecmp(const char *s, const char *t)
 
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+static struct inode* hdirlookup(struct inode*, char*, uint*);
+static int hdirlink(struct inode*, char*, uint);
+static void dirindex(struct inode*);
+
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
@@ -530,6 +948,10 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  // "." and ".." are always the first two entries.
+  if(dp->index && namecmp(name, ".") != 0 && namecmp(name, "..") != 0)
+    return hdirlookup(dp, name, poff);
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -548,6 +970,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
+// Returns -1 if name is already there, or ENOSPC if dp is full.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
@@ -560,6 +983,10 @@ dirlink(struct inode *dp, char *name, uint inum)
     iput(ip);
     return -1;
   }
+  dcacheforget(dp, name);
+
+  if(dp->index)
+    return hdirlink(dp, name, inum);
 
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
@@ -569,6 +996,12 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  // Rather than grow past one block, switch to hashing.
+  if(off == BSIZE){
+    dirindex(dp);
+    return hdirlink(dp, name, inum);
+  }
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
@@ -577,9 +1010,272 @@ dirlink(struct inode *dp, char *name, uint inum)
   return 0;
 }
 
+//PAGEBREAK!
+// Hashed directories
+//
+// A directory starts out as a linear array of dirents.  When it
+// fills its first block, dirlink() gives it a hash index (see
+// fs.h) in a block of its own, and from then on every block of
+// the directory is a bucket: a name lives in the bucket the index
+// maps its hash to, so lookup reads one directory block instead
+// of all of them.  A full bucket is split in two by the next hash
+// bit, doubling the index if no bit is left.  Each block is still
+// a plain array of dirents, so code that scans a directory
+// linearly (ls, isdirempty) works on either kind, and "." and
+// ".." stay in the first two slots of block 0.
+
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;  // FNV-1a
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Give directory dp, whose single block is full, a hash index
+// with one bucket: that block.
+static void
+dirindex(struct inode *dp)
+{
+  uint b;
+
+  b = balloc(dp->dev, 0, 1);  // zeroed: depth 0, bucket 0
+  dp->index = b;
+  iupdate(dp);
+}
+
+// Return the block of hashed directory dp that holds name.
+static uint
+dirbucket(struct inode *dp, char *name)
+{
+  struct buf *bp;
+  struct dirindex *di;
+  uint bn;
+
+  bp = bread(dp->dev, dp->index);
+  di = (struct dirindex*)bp->data;
+  bn = di->bucket[dirhash(name) & ((1 << di->depth) - 1)];
+  brelse(bp);
+  return bn;
+}
+
+static struct inode*
+hdirlookup(struct inode *dp, char *name, uint *poff)
+{
+  uint bn, inum;
+  int i;
+  struct buf *bp;
+  struct dirent *de;
+
+  bn = dirbucket(dp, name);
+  bp = bread(dp->dev, bmap(dp, bn));
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < DPB; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      if(poff)
+        *poff = bn*BSIZE + i*sizeof(*de);
+      inum = de[i].inum;
+      brelse(bp);
+      return iget(dp->dev, inum);
+    }
+  }
+  brelse(bp);
+  return 0;
+}
+
+// Split full block bn of hashed directory dp: entries whose
+// next hash bit is set move to a new block at the end.
+// Returns -1 if the index can't grow any further.
+static int
+dirsplit(struct inode *dp, uint bn)
+{
+  struct buf *ibp, *obp, *nbp;
+  struct dirindex *di;
+  struct dirent *ode, *nde;
+  uint ld, nbn, i, j;
+
+  ibp = bread(dp->dev, dp->index);
+  di = (struct dirindex*)ibp->data;
+  ld = di->ldepth[bn];
+  if(ld == di->depth){
+    if(di->depth == DIRMAXDEPTH){
+      brelse(ibp);
+      return -1;
+    }
+    for(i = 0; i < (1 << di->depth); i++)
+      di->bucket[i + (1 << di->depth)] = di->bucket[i];
+    di->depth++;
+  }
+
+  // Fewer buckets than index slots now, so nbn < NDIRSLOT.
+  nbn = dp->size / BSIZE;
+  for(i = 0; i < (1 << di->depth); i++){
+    if(di->bucket[i] == bn && ((i >> ld) & 1))
+      di->bucket[i] = nbn;
+  }
+  di->ldepth[bn] = di->ldepth[nbn] = ld + 1;
+
+  obp = bread(dp->dev, bmap(dp, bn));
+  nbp = bread(dp->dev, bmap(dp, nbn));
+  ode = (struct dirent*)obp->data;
+  nde = (struct dirent*)nbp->data;
+  for(i = j = 0; i < DPB; i++){
+    if(ode[i].inum == 0 || (bn == 0 && i < 2))
+      continue;  // "." and ".." stay put
+    if((dirhash(ode[i].name) >> ld) & 1){
+      nde[j++] = ode[i];
+      memset(&ode[i], 0, sizeof(ode[i]));
+    }
+  }
+  log_write(obp);
+  log_write(nbp);
+  log_write(ibp);
+  brelse(obp);
+  brelse(nbp);
+  brelse(ibp);
+
+  dp->size += BSIZE;
+  iupdate(dp);
+  return 0;
+}
+
+static int
+hdirlink(struct inode *dp, char *name, uint inum)
+{
+  uint bn;
+  int i, try;
+  struct buf *bp;
+  struct dirent *de;
+
+  // One split makes room unless every entry in the bucket
+  // has the same next hash bit.
+  for(try = 0; try < 2; try++){
+    bn = dirbucket(dp, name);
+    bp = bread(dp->dev, bmap(dp, bn));
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < DPB; i++){
+      if(de[i].inum == 0){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(bp);
+        brelse(bp);
+        return 0;
+      }
+    }
+    brelse(bp);
+    if(try > 0 || dirsplit(dp, bn) < 0)
+      break;
+  }
+  return ENOSPC;
+}
+
 //PAGEBREAK!
 // Paths
 
+// Look up (dp, name) in the dentry cache.  On a hit, set *inum
+// and *type (*inum is 0 if name is known not to exist), and
+// *gen to the generation the entry was valid in.
+static int
+dcachelookup(struct inode *dp, char *name, uint *inum, short *type,
+             uint *gen)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < &dcache.dentry[NDENTRY]; d++){
+    if(d->dinum == dp->inum && d->dev == dp->dev &&
+       namecmp(d->name, name) == 0){
+      *inum = d->inum;
+      *type = d->type;
+      *gen = dcache.gen;
+      d->used = ++dcache.clock;
+      release(&dcache.lock);
+      return 1;
+    }
+  }
+  release(&dcache.lock);
+  return 0;
+}
+
+// Remember the result of looking up name in dp, unless the cache
+// changed since dcachegen() returned gen.
+static void
+dcacheadd(struct inode *dp, char *name, uint inum, short type, uint gen)
+{
+  struct dentry *d, *victim;
+
+  acquire(&dcache.lock);
+  if(gen != dcache.gen){
+    release(&dcache.lock);
+    return;
+  }
+  victim = dcache.dentry;
+  for(d = dcache.dentry; d < &dcache.dentry[NDENTRY]; d++){
+    if(d->dinum == 0){
+      victim = d;
+      break;
+    }
+    if(d->used < victim->used)
+      victim = d;
+  }
+  victim->dev = dp->dev;
+  victim->dinum = dp->inum;
+  strncpy(victim->name, name, DIRSIZ);
+  victim->inum = inum;
+  victim->type = type;
+  victim->used = ++dcache.clock;
+  release(&dcache.lock);
+}
+
+static uint
+dcachegen(void)
+{
+  uint gen;
+
+  acquire(&dcache.lock);
+  gen = dcache.gen;
+  release(&dcache.lock);
+  return gen;
+}
+
+// Forget name in directory dp, which is about to change.
+// Caller must hold dp->lock.
+void
+dcacheforget(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  dcache.gen++;
+  for(d = dcache.dentry; d < &dcache.dentry[NDENTRY]; d++){
+    if(d->dinum == dp->inum && d->dev == dp->dev &&
+       namecmp(d->name, name) == 0)
+      d->dinum = 0;
+  }
+  release(&dcache.lock);
+}
+
+// Forget all entries in or for inode ip, which is being freed.
+static void
+dcachepurge(struct inode *ip)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  dcache.gen++;
+  for(d = dcache.dentry; d < &dcache.dentry[NDENTRY]; d++){
+    if(d->dev == ip->dev && (d->dinum == ip->inum || d->inum == ip->inum))
+      d->dinum = 0;
+  }
+  release(&dcache.lock);
+}
+
 // Copy the next path element from path into name.
 // Return a pointer to the element following the copied one.
 // The returned path has no leading slashes,
@@ -625,28 +1321,54 @@ static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  uint inum, gen;
+  short type;
+  int hit;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
   else
-    ip = idup(myproc()->cwd);
+    ip = filescwd(myproc()->files);
+  type = T_DIR;  // ip's type; the root and cwd are directories
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
-    if(ip->type != T_DIR){
-      iunlockput(ip);
+    if(type != T_DIR){
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
-      return 0;
+    if((hit = dcachelookup(ip, name, &inum, &type, &gen)) != 0){
+      next = inum ? iget(ip->dev, inum) : 0;
+      // The inode may have been unlinked and freed before
+      // iget().  Unlinking forgets the name, changing gen,
+      // before it drops the link, so if gen is unchanged now
+      // that next holds a reference, next can't be freed.
+      if(dcachegen() != gen){
+        if(next)
+          iput(next);
+        hit = 0;
+      }
     }
-    iunlockput(ip);
+    if(!hit){
+      ilock(ip);
+      next = dirlookup(ip, name, 0);
+      gen = dcachegen();
+      iunlock(ip);
+      inum = type = 0;
+      if(next){
+        ilock(next);
+        inum = next->inum;
+        type = next->type;
+        iunlock(next);
+      }
+      dcacheadd(ip, name, inum, type, gen);
+    }
+    iput(ip);
+    if(next == 0)
+      return 0;
     ip = next;
   }
   if(nameiparent){
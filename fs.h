@@ -19,11 +19,36 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint flags;        // FS_* format flags
 };
 
-#define NDIRECT 12
+#define FS_EXTENTS 0x1  // inodes map data blocks with extents
+#define FS_ORDERED 0x2  // only metadata is logged; file data goes home first
+
+// The log is a header block followed by nlog-1 data blocks.
+// The header lists the data blocks' home block numbers, so
+// it limits how large the log can be.
+#define LOGMAX (BSIZE / sizeof(uint) - 1)  // max data blocks in log
+
+#define NDIRECT 9
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
+#define NADDRS (NDIRECT+3)
+
+// With FS_EXTENTS, an inode's addrs[] holds NEXTENT extents
+// instead, each a run of len blocks starting at block start,
+// in file order.  addrs[EXTBLOCK] is an extent block holding
+// NEXTBLK more; the odd addrs[] entry before it is unused.
+// Unused extents have len 0.
+struct extent {
+  uint start;
+  uint len;
+};
+#define NEXTENT ((NADDRS-1) / 2)
+#define EXTBLOCK (NADDRS-1)
+#define NEXTBLK (BSIZE / sizeof(struct extent))
 
 // On-disk inode structure
 struct dinode {
@@ -32,7 +57,8 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint index;           // Hash index block (T_DIR only), or 0
+  uint addrs[NADDRS];   // Data block addresses
 };
 
 // Inodes per block.
@@ -55,3 +81,26 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Directory entries per block
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A directory that outgrows one block gets a hash index: an
+// extendible hash table mapping the low depth bits of a name's
+// hash to the directory block (bucket) holding the name.  The
+// index block's number is kept in the directory inode's index
+// field.  The index maps at most NDIRSLOT buckets, so a hashed
+// directory holds at most NDIRSLOT*DPB entries, fewer if the
+// names' hashes are uneven.
+#define DIRMAXDEPTH 7
+#define NDIRSLOT (1 << DIRMAXDEPTH)
+
+// What link(), mkdir(), mknod() and open() with O_CREATE return
+// when the directory has no room for another entry.
+#define ENOSPC (-3)
+
+struct dirindex {
+  uint depth;                // hash bits in use
+  ushort bucket[NDIRSLOT];   // directory block for each hash value
+  uchar ldepth[NDIRSLOT];    // hash bits shared within each block
+};
+
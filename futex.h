@@ -0,0 +1,3 @@
+// futex() operations
+#define FUTEX_WAIT 0  // sleep while *addr == val
+#define FUTEX_WAKE 1  // wake up to val processes waiting on addr
@@ -1,4 +1,6 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.
+// Uses bus-master DMA when a PCI IDE controller that supports it
+// is present (e.g. QEMU's PIIX), and programmed I/O otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +14,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,6 +26,28 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_READ_DMA  0xc8
+#define IDE_CMD_WRITE_DMA 0xca
+
+// Bus-master IDE registers for the primary channel,
+// relative to the I/O base in PCI BAR4.
+#define BM_CMD        0x00
+#define BM_STATUS     0x02
+#define BM_PRDT       0x04
+
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // direction: disk to memory
+#define BM_STATUS_ERR 0x02
+#define BM_STATUS_IRQ 0x04
+
+// Physical region descriptor: one physically contiguous
+// piece of a DMA transfer.  May not cross a 64K boundary.
+struct prd {
+  uint addr;
+  ushort count;         // bytes (0 means 64K)
+  ushort flags;
+};
+#define PRD_EOT 0x8000  // last entry in the table
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
@@ -32,8 +57,15 @@ static struct spinlock idelock;
 static struct buf *idequeue;
 
 static int havedisk1;
+static int havevirtio;  // virtio disk stands in for disk 1
 static void idestart(struct buf*);
 
+// A block is at most two regions: one on each side of a 64K boundary.
+// 16-byte alignment keeps the table itself inside one 64K page.
+static int havedma;
+static uint bmbase;
+static struct prd prdt[2] __attribute__((aligned(16)));
+
 // Wait for IDE disk to become ready.
 static int
 idewait(int checkerr)
@@ -47,6 +79,26 @@ idewait(int checkerr)
   return 0;
 }
 
+// Look for a PCI IDE controller capable of bus mastering.
+// Without one, the driver stays with programmed I/O.
+static void
+idedmainit(void)
+{
+  struct pcidev d;
+
+  if(pcifindclass(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &d) < 0)
+    return;
+  if((d.progif & 0x80) == 0 || (d.bar[4] & PCI_BAR_IO) == 0)
+    return;
+  if((d.bar[4] & ~3) == 0)
+    return;
+  pciconfwrite(&d, PCI_COMMAND,
+               pciconfread(&d, PCI_COMMAND) | PCI_CMD_IO | PCI_CMD_MASTER);
+  bmbase = d.bar[4] & ~3;
+  havedma = 1;
+  cprintf("ide: bus-master dma at 0x%x\n", bmbase);
+}
+
 void
 ideinit(void)
 {
@@ -67,6 +119,41 @@ ideinit(void)
 
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  idedmainit();
+
+  // With no IDE disk 1, look for the file system on a virtio disk.
+  if(!havedisk1 && virtioinit() == 0)
+    havevirtio = 1;
+}
+
+// Point the bus master at b->data and set the transfer direction.
+// Caller must hold idelock.
+static void
+idedmaprep(struct buf *b)
+{
+  struct prd *p;
+  uint pa, n, left;
+
+  p = prdt;
+  pa = V2P(b->data);
+  for(left = BSIZE; ; p++){
+    n = 0x10000 - (pa & 0xffff);
+    if(n > left)
+      n = left;
+    p->addr = pa;
+    p->count = n;
+    p->flags = 0;
+    pa += n;
+    left -= n;
+    if(left == 0)
+      break;
+  }
+  p->flags = PRD_EOT;
+
+  outl(bmbase+BM_PRDT, V2P(prdt));
+  outb(bmbase+BM_STATUS, BM_STATUS_ERR|BM_STATUS_IRQ);  // write 1 to clear
+  outb(bmbase+BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_CMD_READ);
 }
 
 // Start the request for b.  Caller must hold idelock.
@@ -84,6 +171,8 @@ idestart(struct buf *b)
 
   if (sector_per_block > 7) panic("idestart");
 
+  if(havedma)
+    idedmaprep(b);
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
   outb(0x1f2, sector_per_block);  // number of sectors
@@ -91,7 +180,11 @@ idestart(struct buf *b)
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(havedma){
+    // The controller moves the data; ideintr() runs when it is done.
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRITE_DMA : IDE_CMD_READ_DMA);
+    outb(bmbase+BM_CMD, inb(bmbase+BM_CMD) | BM_CMD_START);
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
     outsl(0x1f0, b->data, BSIZE/4);
   } else {
@@ -104,6 +197,7 @@ void
 ideintr(void)
 {
   struct buf *b;
+  int st;
 
   // First queued buffer is the active request.
   acquire(&idelock);
@@ -112,11 +206,26 @@ ideintr(void)
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+  if(havedma){
+    // Stop the bus master and acknowledge its interrupt.
+    // The data is already in (or out of) b->data.
+    st = inb(bmbase+BM_STATUS);
+    outb(bmbase+BM_CMD, 0);
+    outb(bmbase+BM_STATUS, BM_STATUS_ERR|BM_STATUS_IRQ);
+    if(idewait(1) < 0 || (st & BM_STATUS_ERR)){
+      // Retry b, and everything after it, with programmed I/O.
+      cprintf("ide: dma error, using pio\n");
+      havedma = 0;
+      idestart(b);
+      release(&idelock);
+      return;
+    }
+  } else if(!(b->flags & B_DIRTY) && idewait(1) >= 0){
+    // Read data if needed.
     insl(0x1f0, b->data, BSIZE/4);
+  }
+  idequeue = b->qnext;
 
   // Wake process waiting for this buf.
   b->flags |= B_VALID;
@@ -143,6 +252,10 @@ iderw(struct buf *b)
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
     panic("iderw: nothing to do");
+  if(b->dev != 0 && havevirtio){
+    virtiorw(b);
+    return;
+  }
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
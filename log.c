@@ -5,6 +5,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "stat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -15,10 +16,17 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
+// its start and end. Usually begin_op() just reserves
+// MAXOPBLOCKS blocks of log space and returns.
+// But if the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
+// An operation that may write more, like a large write(),
+// reserves what it needs with begin_opn()/end_opn().
+//
+// Commit is a group commit: when the last outstanding end_op()
+// finds room left in the log, it leaves the transaction open
+// and the flusher commits it COMMITDELAY ticks later, so that
+// FS calls arriving in the meantime share one commit.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,69 +36,158 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// Logged blocks stay pinned in the buffer cache until they are
+// installed, so neither commit nor install reads the log back:
+// write_log() writes the cached data to the log, and the
+// flusher writes the same cached buffers to their home locations.
+//
+// On an FS_ORDERED file system, file data is not logged:
+// log_data() writes a data block straight to its home location,
+// before the transaction that maps it into a file commits.
+// Only metadata is in the log, so recover_from_log() restores
+// consistent metadata, and a file's data is on disk by the time
+// its metadata says it is there.  A data block still goes through
+// the log if the running transaction logged or freed it, since
+// overwriting it in place would corrupt the committed metadata
+// or file data that still owns it.
+//
+// Installing a committed transaction (copying its blocks to
+// their home locations) is left to the flusher kernel thread,
+// so end_op() returns once the header is written.  FS system
+// calls keep running meanwhile and build the next transaction
+// in memory; only its commit has to wait for the install to
+// finish, since the on-disk log holds one transaction at a time.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int block[LOGMAX];
 };
 
+#define COMMITDELAY 1  // ticks a transaction stays open for more FS calls
+
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // header block + data blocks, from the superblock
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks reserved by them.
   int committing;  // in commit(), please wait.
+  int installing;  // flusher is installing ilh, please wait.
+  int pending;     // flusher should commit lh soon.
+  int spacewait;   // a begin_op() is waiting for log space.
   int dev;
-  struct logheader lh;
+  struct logheader lh;   // transaction being built
+  struct logheader ilh;  // committed transaction being installed
+  struct buf ibuf;       // private buffer for log blocks, not in the cache
+  int absorbed;          // log_write()s absorbed in lh
+  int ordered;           // FS_ORDERED: file data bypasses the log
+  int nfreed;            // blocks freed in lh, -1 if too many
+  uint freed[LOGMAX];
+  struct logstat stat;
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void flusher(void);
 
 void
 initlog(int dev)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
   initlock(&log.lock, "log");
+  initsleeplock(&log.ibuf.lock, "logbuf");
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
   log.dev = dev;
+  log.ordered = (sb.flags & FS_ORDERED) != 0;
+  if (log.size - 1 > LOGMAX || log.size - 1 < MAXOPBLOCKS)
+    panic("initlog: bad log size");
   recover_from_log();
+  if(kthread("flusher", flusher) < 0)
+    panic("initlog: flusher");
+}
+
+// Copy disk block from to disk block to through log.ibuf,
+// leaving the buffer cache alone.
+static void
+copy_block(uint from, uint to)
+{
+  acquiresleep(&log.ibuf.lock);
+  log.ibuf.dev = log.dev;
+  log.ibuf.blockno = from;
+  log.ibuf.flags = 0;
+  iderw(&log.ibuf);  // read src
+  log.ibuf.blockno = to;
+  log.ibuf.flags |= B_DIRTY;
+  iderw(&log.ibuf);  // write dst
+  releasesleep(&log.ibuf.lock);
+}
+
+// Is block blockno part of the transaction being built?
+static int
+in_lh(uint blockno)
+{
+  int i, r;
+
+  r = 0;
+  acquire(&log.lock);
+  for (i = 0; i < log.lh.n; i++) {
+    if (log.lh.block[i] == blockno) {
+      r = 1;
+      break;
+    }
+  }
+  release(&log.lock);
+  return r;
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks to their home location.
+// Unless recovering, the home blocks are still pinned in the
+// cache by log_write(), and are written from there.  The
+// exception is a block that the next transaction has already
+// modified again: its cached copy is not committed yet, so
+// the committed copy is taken from the log instead.
 static void
-install_trans(void)
+install_trans(struct logheader *lh, int recovering)
 {
   int tail;
+  struct buf *dbuf;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
+  for (tail = 0; tail < lh->n; tail++) {
+    if(recovering){
+      copy_block(log.start+tail+1, lh->block[tail]);
+      continue;
+    }
+    dbuf = bread(log.dev, lh->block[tail]);  // cache hit: pinned
+    // Holding dbuf's lock keeps it out of the running
+    // transaction until it has been written.
+    if(in_lh(dbuf->blockno))
+      copy_block(log.start+tail+1, dbuf->blockno);
+    else
+      bwrite(dbuf);  // write dst to disk
+    bunpin(dbuf);
     brelse(dbuf);
   }
 }
 
 // Read the log header from disk into the in-memory log header
 static void
-read_head(void)
+read_head(struct logheader *h)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  h->n = lh->n;
+  for (i = 0; i < h->n; i++) {
+    h->block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -99,14 +196,14 @@ read_head(void)
 // This is the true point at which the
 // current transaction commits.
 static void
-write_head(void)
+write_head(struct logheader *h)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = h->n;
+  for (i = 0; i < h->n; i++) {
+    hb->block[i] = h->block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -115,45 +212,128 @@ write_head(void)
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
+  read_head(&log.lh);
+  install_trans(&log.lh, 1); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  write_head(&log.lh); // clear the log
 }
 
-// called at the start of each FS system call.
+// The flusher thread: install each committed transaction,
+// then erase it from the log so the next one can commit.
+// Also commits the open transaction when end_op() asked for
+// a group commit.
+static void
+flusher(void)
+{
+  uint ticks0;
+
+  acquire(&log.lock);
+  for(;;){
+    if(log.installing){
+      release(&log.lock);
+      install_trans(&log.ilh, 0);
+      log.ilh.n = 0;
+      write_head(&log.ilh);    // Erase the transaction from the log
+      acquire(&log.lock);
+      log.installing = 0;
+      wakeup(&log);
+    } else if(log.pending){
+      // Give more FS calls a chance to join the transaction.
+      release(&log.lock);
+      acquire(&tickslock);
+      ticks0 = ticks;
+      while(ticks - ticks0 < COMMITDELAY)
+        sleep(&ticks, &tickslock);
+      release(&tickslock);
+      acquire(&log.lock);
+      // If an FS call is still running, try again next tick.
+      if(log.pending && log.outstanding == 0 &&
+         !log.committing && !log.installing){
+        log.pending = 0;
+        log.committing = 1;
+        release(&log.lock);
+        commit();
+        acquire(&log.lock);
+        log.committing = 0;
+        wakeup(&log);
+      }
+    } else {
+      sleep(&log.ilh, &log.lock);
+    }
+  }
+}
+
+// The most log blocks one operation may reserve: half the
+// log, so that a large write leaves room for other FS calls.
+int
+log_maxop(void)
+{
+  if((log.size-1) / 2 < MAXOPBLOCKS)
+    return MAXOPBLOCKS;
+  return (log.size-1) / 2;
+}
+
+// called at the start of an FS system call that
+// writes at most n blocks.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  if(n > log_maxop())
+    panic("begin_opn");
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > log.size-1){
       // this op might exhaust log space; wait for commit.
+      log.spacewait = 1;
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
 }
 
+// called at the start of each FS system call.
+void
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 void
 end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// called at the end of an FS system call started
+// with begin_opn(n).
+// if this was the last outstanding operation, commits,
+// or asks the flusher to commit shortly if the log has room.
+void
+end_opn(int n)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= n;
   if(log.committing)
     panic("log.committing");
   if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+    if(log.spacewait || log.lh.n + MAXOPBLOCKS > log.size-1){
+      do_commit = 1;
+      log.committing = 1;
+      log.spacewait = 0;
+    } else if(log.lh.n > 0 && !log.pending){
+      log.pending = 1;
+      wakeup(&log.ilh);
+    }
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -174,35 +354,93 @@ end_op(void)
 }
 
 // Copy modified blocks from cache to log.
+// The log blocks are written through log.ibuf, so they are
+// neither read first nor kept in the cache.
 static void
 write_log(void)
 {
   int tail;
+  struct buf *from;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    from = bread(log.dev, log.lh.block[tail]); // cache block
+    acquiresleep(&log.ibuf.lock);
+    log.ibuf.dev = log.dev;
+    log.ibuf.blockno = log.start+tail+1;
+    log.ibuf.flags = B_VALID|B_DIRTY;
+    memmove(log.ibuf.data, from->data, BSIZE);
+    iderw(&log.ibuf);  // write the log
+    releasesleep(&log.ibuf.lock);
     brelse(from);
-    brelse(to);
   }
 }
 
+// Sort the logged block numbers, so that the log is
+// installed in one sweep across the disk.
+static void
+sort_head(struct logheader *h)
+{
+  int i, j, b;
+
+  for (i = 1; i < h->n; i++) {
+    b = h->block[i];
+    for (j = i; j > 0 && h->block[j-1] > b; j--)
+      h->block[j] = h->block[j-1];
+    h->block[j] = b;
+  }
+}
+
+static uint
+curticks(void)
+{
+  uint t;
+
+  acquire(&tickslock);
+  t = ticks;
+  release(&tickslock);
+  return t;
+}
+
 static void
 commit()
 {
+  uint t0;
+
   if (log.lh.n > 0) {
+    t0 = curticks();
+    // The log holds one transaction; wait for the
+    // flusher to finish installing the previous one.
+    acquire(&log.lock);
+    while(log.installing)
+      sleep(&log, &log.lock);
+    release(&log.lock);
+
+    sort_head(&log.lh);
     write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
+    write_head(&log.lh);  // Write header to disk -- the real commit
+
+    // Hand the transaction to the flusher to install.
+    acquire(&log.lock);
+    log.stat.ncommit++;
+    log.stat.lastlogged = log.lh.n;
+    log.stat.lastabsorbed = log.absorbed;
+    log.stat.lastticks = curticks() - t0;
+    log.stat.nlogged += log.stat.lastlogged;
+    log.stat.nabsorbed += log.stat.lastabsorbed;
+    log.stat.nticks += log.stat.lastticks;
+    log.absorbed = 0;
+    log.nfreed = 0;
+    log.ilh = log.lh;
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.installing = 1;
+    wakeup(&log.ilh);
+    release(&log.lock);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
-// Record the block number and pin in the cache with B_DIRTY.
+// Record the block number and pin b in the cache until the
+// flusher has installed it.
 // commit()/write_log() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
@@ -215,7 +453,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.size - 1)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -226,9 +464,59 @@ log_write(struct buf *b)
       break;
   }
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n) {  // Add new block to log?
+    bpin(b);
     log.lh.n++;
-  b->flags |= B_DIRTY; // prevent eviction
+  } else
+    log.absorbed++;
+  release(&log.lock);
+}
+
+// Caller has modified data block b of a file on an
+// FS_ORDERED file system and is done with the buffer.
+// Write it home now, unless it must go through the log
+// because the running transaction logged or freed it.
+void
+log_data(struct buf *b)
+{
+  int i, logit;
+
+  acquire(&log.lock);
+  logit = log.nfreed < 0;
+  for (i = 0; !logit && i < log.lh.n; i++)
+    logit = log.lh.block[i] == b->blockno;
+  for (i = 0; !logit && i < log.nfreed; i++)
+    logit = log.freed[i] == b->blockno;
+  release(&log.lock);
+
+  if(logit)
+    log_write(b);
+  else
+    bwrite(b);
+}
+
+// Note that the running transaction freed block blockno, so
+// log_data() must not overwrite it in place.
+// If too many are freed, all data is logged until the commit.
+void
+log_free(uint blockno)
+{
+  if(!log.ordered)
+    return;
+  acquire(&log.lock);
+  if(log.nfreed >= 0 && log.nfreed < LOGMAX)
+    log.freed[log.nfreed++] = blockno;
+  else
+    log.nfreed = -1;
+  release(&log.lock);
+}
+
+// Copy the log statistics to *st.
+void
+logstat(struct logstat *st)
+{
+  acquire(&log.lock);
+  *st = log.stat;
   release(&log.lock);
 }
 
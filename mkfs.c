@@ -15,14 +15,17 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 2000
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
+int fssize = FSSIZE;  // total blocks (mkfs -s)
+int nbitmap;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGSIZE;   // header block + data blocks
+int extents;  // write an FS_EXTENTS file system
+int ordered;  // write an FS_ORDERED file system
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -40,6 +43,8 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+uint emap(struct dinode *din, uint fbn);
+uint ientry(uint *ap, uint i);
 
 // convert to intel byte order
 ushort
@@ -76,8 +81,36 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  // Options precede the image name.
+  while(argc > 2 && argv[1][0] == '-'){
+    if(strcmp(argv[1], "-l") == 0 && argc > 3){
+      nlog = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if(strcmp(argv[1], "-s") == 0 && argc > 3){
+      fssize = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if(strcmp(argv[1], "-x") == 0){
+      extents = 1;
+      argc--;
+      argv++;
+    } else if(strcmp(argv[1], "-o") == 0){
+      ordered = 1;
+      argc--;
+      argv++;
+    } else {
+      argc = 0;  // print usage
+    }
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l nlog] [-s size] [-x] [-o] fs.img files...\n");
+    exit(1);
+  }
+  if(nlog < MAXOPBLOCKS+1 || nlog > LOGMAX+1){
+    fprintf(stderr, "mkfs: log must have %d to %d blocks\n",
+            MAXOPBLOCKS+1, (int)LOGMAX+1);
     exit(1);
   }
 
@@ -91,23 +124,30 @@ main(int argc, char *argv[])
   }
 
   // 1 fs block = 1 disk sector
+  nbitmap = fssize/(BSIZE*8) + 1;
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  nblocks = fssize - nmeta;
+  if(fssize > FSSIZE || nblocks <= 0){
+    fprintf(stderr, "mkfs: size must be over %d and at most %d blocks\n",
+            nmeta, FSSIZE);
+    exit(1);
+  }
 
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
   sb.ninodes = xint(NINODES);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.flags = xint((extents ? FS_EXTENTS : 0) | (ordered ? FS_ORDERED : 0));
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
+  for(i = 0; i < fssize; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
@@ -259,30 +299,27 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
-  uint x;
+  uint x, ibn;
 
   rinode(inum, &din);
   off = xint(din.size);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
+    if(extents){
+      x = emap(&din, fbn);
+    } else if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
+    } else if(fbn < NDIRECT + NINDIRECT){
+      x = ientry(&din.addrs[NDIRECT], fbn - NDIRECT);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
+      ibn = fbn - NDIRECT - NINDIRECT;
+      assert(ibn < NDINDIRECT);
+      x = xint(ientry(&din.addrs[NDIRECT+1], ibn / NINDIRECT));
+      x = ientry(&x, ibn % NINDIRECT);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -295,3 +332,69 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Return the block holding block fbn of extent-format inode din.
+// If fbn is just past the end of the file, allocate the next
+// free block, growing the last extent when it ends there.
+uint
+emap(struct dinode *din, uint fbn)
+{
+  struct extent ext[NEXTBLK], *e, *last;
+  uint lbn, x;
+  int i;
+
+  if(xint(din->addrs[EXTBLOCK]) != 0)
+    rsect(xint(din->addrs[EXTBLOCK]), (char*)ext);
+  lbn = 0;
+  e = last = 0;
+  for(i = 0; i < NEXTENT + NEXTBLK; i++){
+    if(i < NEXTENT)
+      e = (struct extent*)din->addrs + i;
+    else if(xint(din->addrs[EXTBLOCK]) == 0)
+      break;
+    else
+      e = &ext[i - NEXTENT];
+    if(xint(e->len) == 0)
+      break;
+    if(fbn < lbn + xint(e->len))
+      return xint(e->start) + fbn - lbn;
+    lbn += xint(e->len);
+    last = e;
+  }
+  assert(fbn == lbn);
+
+  if(last && xint(last->start) + xint(last->len) == freeblock){
+    last->len = xint(xint(last->len) + 1);
+    e = last;
+  } else {
+    assert(i < NEXTENT + NEXTBLK);
+    if(i >= NEXTENT && xint(din->addrs[EXTBLOCK]) == 0){
+      din->addrs[EXTBLOCK] = xint(freeblock++);
+      bzero(ext, sizeof(ext));
+      e = &ext[0];
+    }
+    e->start = xint(freeblock);
+    e->len = xint(1);
+  }
+  x = freeblock++;
+  if(e >= ext && e < ext + NEXTBLK)
+    wsect(xint(din->addrs[EXTBLOCK]), (char*)ext);
+  return x;
+}
+
+// Return entry i of the indirect block *ap, allocating the
+// indirect block if *ap is 0 and the entry if it is 0.
+uint
+ientry(uint *ap, uint i)
+{
+  uint indirect[NINDIRECT];
+
+  if(xint(*ap) == 0)
+    *ap = xint(freeblock++);  // the image starts out zeroed
+  rsect(xint(*ap), (char*)indirect);
+  if(indirect[i] == 0){
+    indirect[i] = xint(freeblock++);
+    wsect(xint(*ap), (char*)indirect);
+  }
+  return xint(indirect[i]);
+}
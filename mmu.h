@@ -2,6 +2,7 @@
 // x86 memory management unit (MMU).
 
 // Eflags register
+#define FL_TF           0x00000100      // Trap Flag
 #define FL_IF           0x00000200      // Interrupt Enable
 
 // Control Register flags
@@ -11,6 +12,11 @@
 
 #define CR4_PSE         0x00000010      // Page size extension
 
+// Model-specific registers for SYSENTER/SYSEXIT
+#define MSR_SYSENTER_CS  0x174          // Kernel %cs; %ss and user segs follow
+#define MSR_SYSENTER_ESP 0x175          // Kernel %esp on entry
+#define MSR_SYSENTER_EIP 0x176          // Kernel entry point
+
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
 #define SEG_KDATA 2  // kernel data+stack
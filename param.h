@@ -2,13 +2,15 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NFILE       100  // open files per system before growing
+#define PIPEMAXPG    16  // most pages in a pipe's buffer (a power of 2)
+#define NINODE       50  // in-memory i-nodes kept before recycling
+#define NDENTRY      64  // size of directory entry cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*12)  // default size of on-disk log (mkfs -l)
+#define NBUF         (LOGMAX*2+MAXOPBLOCKS*3)  // size of disk block cache
+#define FSSIZE       20000  // size of file system in blocks
 
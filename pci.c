@@ -0,0 +1,89 @@
+// Minimal PCI support: a configuration space scan so that
+// drivers can find their controller and its I/O ports.
+// Only bus 0..255 with configuration mechanism #1,
+// which is what QEMU and every PC since the 90s provide.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+static uint
+pciaddr(uint bus, uint dev, uint func, uint off)
+{
+  return 0x80000000 | (bus<<16) | (dev<<11) | (func<<8) | (off & 0xfc);
+}
+
+static uint
+pciread(uint bus, uint dev, uint func, uint off)
+{
+  outl(PCI_CONFADDR, pciaddr(bus, dev, func, off));
+  return inl(PCI_CONFDATA);
+}
+
+uint
+pciconfread(struct pcidev *d, uint off)
+{
+  return pciread(d->bus, d->dev, d->func, off);
+}
+
+void
+pciconfwrite(struct pcidev *d, uint off, uint val)
+{
+  outl(PCI_CONFADDR, pciaddr(d->bus, d->dev, d->func, off));
+  outl(PCI_CONFDATA, val);
+}
+
+// Find the first function whose configuration register reg,
+// masked with mask, equals key.  Fill in *d and return 0,
+// or return -1 if there is no such function.
+static int
+pciscan(uint reg, uint mask, uint key, struct pcidev *d)
+{
+  uint bus, dev, func, nfunc, id, v;
+  int i;
+
+  for(bus = 0; bus < 256; bus++){
+    for(dev = 0; dev < 32; dev++){
+      if((pciread(bus, dev, 0, PCI_ID) & 0xffff) == 0xffff)
+        continue;
+      // Only multi-function devices have functions 1-7.
+      nfunc = (pciread(bus, dev, 0, PCI_HEADER) & 0x800000) ? 8 : 1;
+      for(func = 0; func < nfunc; func++){
+        id = pciread(bus, dev, func, PCI_ID);
+        if((id & 0xffff) == 0xffff)
+          continue;
+        if((pciread(bus, dev, func, reg) & mask) != key)
+          continue;
+        d->bus = bus;
+        d->dev = dev;
+        d->func = func;
+        d->vendor = id & 0xffff;
+        d->device = id >> 16;
+        v = pciread(bus, dev, func, PCI_CLASS);
+        d->class = v >> 24;
+        d->subclass = v >> 16;
+        d->progif = v >> 8;
+        d->irq = pciread(bus, dev, func, PCI_INTR) & 0xff;
+        for(i = 0; i < 6; i++)
+          d->bar[i] = pciread(bus, dev, func, PCI_BAR0 + 4*i);
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+// Find a device by class and subclass.
+int
+pcifindclass(uchar class, uchar subclass, struct pcidev *d)
+{
+  return pciscan(PCI_CLASS, 0xffff0000, (class<<24) | (subclass<<16), d);
+}
+
+// Find a device by vendor and device id.
+int
+pcifinddev(ushort vendor, ushort device, struct pcidev *d)
+{
+  return pciscan(PCI_ID, 0xffffffff, (device<<16) | vendor, d);
+}
@@ -0,0 +1,38 @@
+// PCI configuration space, accessed through I/O ports
+// (configuration mechanism #1).
+
+#define PCI_CONFADDR    0xCF8   // configuration address port
+#define PCI_CONFDATA    0xCFC   // configuration data port
+
+// Configuration space registers (type 0 header).
+#define PCI_ID          0x00    // device id (high), vendor id (low)
+#define PCI_COMMAND     0x04    // status (high), command (low)
+#define PCI_CLASS       0x08    // class, subclass, prog if, revision
+#define PCI_HEADER      0x0C    // BIST, header type, latency, cache line
+#define PCI_BAR0        0x10    // base address registers 0-5
+#define PCI_INTR        0x3C    // max lat, min gnt, intr pin, intr line
+
+// Command register bits.
+#define PCI_CMD_IO      0x0001  // respond to I/O space accesses
+#define PCI_CMD_MEM     0x0002  // respond to memory space accesses
+#define PCI_CMD_MASTER  0x0004  // device may master the bus (DMA)
+
+#define PCI_BAR_IO      0x1     // BAR describes I/O space
+
+// Class codes.
+#define PCI_CLASS_STORAGE  0x01
+#define PCI_SUBCLASS_IDE   0x01
+
+// A PCI function found by pcifind().
+struct pcidev {
+  uint bus;
+  uint dev;
+  uint func;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar progif;
+  uchar irq;            // interrupt line routed by the BIOS
+  uint bar[6];          // raw base address registers
+};
@@ -7,18 +7,96 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+#include "fcntl.h"
 
-#define PIPESIZE 512
-
+// The pipe's data is a ring of npage pages, a power of two,
+// so that nread and nwrite wrap around consistently.
+// Byte i of the ring is at page[i / PGSIZE][i % PGSIZE].
+//
+// splice() copies to or from the ring without holding lock,
+// since it may wait for the disk, so it first takes the read
+// or write side of the pipe by setting reading or writing.
+// piperead() and pipewrite() copy under lock, and only wait
+// for such a splice() to finish.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  int reading;    // a splice() is reading from the ring
+  int writing;    // a splice() is writing to the ring
+  char *page[PIPEMAXPG];
+  uint npage;
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+#define PIPESIZE(p) ((p)->npage * PGSIZE)
+
+// Return the address of byte off of p's ring, and
+// in *n how many bytes follow it in the same page.
+static char*
+pipeaddr(struct pipe *p, uint off, uint *n)
+{
+  off %= PIPESIZE(p);
+  *n = PGSIZE - off % PGSIZE;
+  return p->page[off / PGSIZE] + off % PGSIZE;
+}
+
+// Wake up piperead() or pipewrite() sleeping on chan,
+// and poll() too.
+static void
+pipewakeup(void *chan)
+{
+  wakeup(chan);
+  pollwakeup();
+}
+
+// Wait for no splice() to be using the side of p that
+// *side guards.  Caller holds p->lock.  Unlike a sleeplock,
+// this gives up if the caller is killed, or at once if
+// nonblock is set.  Returns 0, -1, or EAGAIN.
+static int
+pipeidle(struct pipe *p, int *side, int nonblock)
+{
+  while(*side){
+    if(myproc()->killed)
+      return -1;
+    if(nonblock)
+      return EAGAIN;
+    sleep(side, &p->lock);
+  }
+  return 0;
+}
+
+// Take the side of p that *side guards.  Caller holds p->lock.
+static int
+pipetake(struct pipe *p, int *side)
+{
+  if(pipeidle(p, side, 0) < 0)
+    return -1;
+  *side = 1;
+  return 0;
+}
+
+// Give back a side taken with pipetake().  Caller holds p->lock.
+static void
+pipegive(int *side)
+{
+  *side = 0;
+  wakeup(side);
+}
+
+static void
+pipefree(struct pipe *p)
+{
+  int i;
+
+  for(i = 0; i < p->npage; i++)
+    kfree(p->page[i]);
+  kfree((char*)p);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,25 +108,33 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  p->npage = 0;
+  if((p->page[0] = kalloc()) == 0)
+    goto bad;
+  p->npage = 1;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
+  p->reading = 0;
+  p->writing = 0;
   initlock(&p->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
+  (*f0)->nonblock = 0;
   (*f0)->pipe = p;
   (*f1)->type = FD_PIPE;
   (*f1)->readable = 0;
   (*f1)->writable = 1;
+  (*f1)->nonblock = 0;
   (*f1)->pipe = p;
   return 0;
 
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    pipefree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -62,60 +148,280 @@ pipeclose(struct pipe *p, int writable)
   acquire(&p->lock);
   if(writable){
     p->writeopen = 0;
-    wakeup(&p->nread);
+    pipewakeup(&p->nread);
   } else {
     p->readopen = 0;
-    wakeup(&p->nwrite);
+    pipewakeup(&p->nwrite);
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    pipefree(p);
   } else
     release(&p->lock);
 }
 
+// Set the size of p's ring to at least n bytes, rounded up to
+// a power-of-two number of pages.  Returns the new size, or -1
+// if n is too large or smaller than the data in the pipe.
+int
+piperesize(struct pipe *p, int n)
+{
+  char *page[PIPEMAXPG], *src;
+  uint npage, i, m, off;
+
+  if(n < 0 || n > PIPEMAXPG * PGSIZE)
+    return -1;
+  for(npage = 1; npage * PGSIZE < n; npage *= 2)
+    ;
+  for(i = 0; i < npage; i++){
+    if((page[i] = kalloc()) == 0){
+      while(i > 0)
+        kfree(page[--i]);
+      return -1;
+    }
+  }
+
+  acquire(&p->lock);
+  if(pipetake(p, &p->writing) < 0)
+    goto bad;
+  if(pipetake(p, &p->reading) < 0){
+    pipegive(&p->writing);
+    goto bad;
+  }
+  if(p->nwrite - p->nread > npage * PGSIZE){
+    pipegive(&p->reading);
+    pipegive(&p->writing);
+    goto bad;
+  }
+  // Move the data to the start of the new ring.
+  for(i = 0, off = p->nread; off != p->nwrite; i += m, off += m){
+    src = pipeaddr(p, off, &m);
+    if(m > p->nwrite - off)
+      m = p->nwrite - off;
+    if(m > PGSIZE - i % PGSIZE)
+      m = PGSIZE - i % PGSIZE;
+    memmove(page[i / PGSIZE] + i % PGSIZE, src, m);
+  }
+  for(i = 0; i < p->npage; i++)
+    kfree(p->page[i]);
+  for(i = 0; i < npage; i++)
+    p->page[i] = page[i];
+  p->npage = npage;
+  p->nwrite -= p->nread;
+  p->nread = 0;
+  pipewakeup(&p->nwrite);
+  pipegive(&p->reading);
+  pipegive(&p->writing);
+  release(&p->lock);
+  return npage * PGSIZE;
+
+bad:
+  release(&p->lock);
+  for(i = 0; i < npage; i++)
+    kfree(page[i]);
+  return -1;
+}
+
+int
+pipesize(struct pipe *p)
+{
+  return PIPESIZE(p);
+}
+
+// For poll(): is there data to read, or room to write,
+// and is the other end still open?
+int
+pipepoll(struct pipe *p, int writable)
+{
+  int r;
+
+  r = 0;
+  acquire(&p->lock);
+  if(writable){
+    if(p->readopen == 0)
+      r |= POLLHUP;
+    else if(p->nwrite != p->nread + PIPESIZE(p))
+      r |= POLLOUT;
+  } else {
+    if(p->nread != p->nwrite)
+      r |= POLLIN;
+    if(p->writeopen == 0)
+      r |= POLLHUP;
+  }
+  release(&p->lock);
+  return r;
+}
+
 //PAGEBREAK: 40
+// Copy data in runs that don't wrap around or cross a page,
+// waking the other side only when the ring fills or empties.
+// If nonblock is set, return what fits rather than wait,
+// or EAGAIN if nothing does.
 int
-pipewrite(struct pipe *p, char *addr, int n)
+pipewrite(struct pipe *p, char *addr, int n, int nonblock)
 {
-  int i;
+  int i, r;
+  uint m;
+  char *dst;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+  for(i = 0; i < n; i += m){
+    while(p->writing || p->nwrite == p->nread + PIPESIZE(p)){  //DOC: pipewrite-full
+      if((r = pipeidle(p, &p->writing, nonblock)) != 0){
+        release(&p->lock);
+        return r == EAGAIN && i > 0 ? i : r;
+      }
+      if(p->nwrite != p->nread + PIPESIZE(p))
+        break;
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
+      pipewakeup(&p->nread);
+      if(nonblock){
+        release(&p->lock);
+        return i > 0 ? i : EAGAIN;
+      }
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    dst = pipeaddr(p, p->nwrite, &m);
+    if(m > n - i)
+      m = n - i;
+    if(m > p->nread + PIPESIZE(p) - p->nwrite)
+      m = p->nread + PIPESIZE(p) - p->nwrite;
+    memmove(dst, addr + i, m);
+    p->nwrite += m;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+  pipewakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
 
+// If nonblock is set, return EAGAIN rather than wait for data.
 int
-piperead(struct pipe *p, char *addr, int n)
+piperead(struct pipe *p, char *addr, int n, int nonblock)
 {
-  int i;
+  int i, r;
+  uint m;
+  char *src;
 
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
-    if(myproc()->killed){
+  while(p->reading || (p->nread == p->nwrite && p->writeopen)){  //DOC: pipe-empty
+    if((r = pipeidle(p, &p->reading, nonblock)) != 0){
       release(&p->lock);
-      return -1;
+      return r;
+    }
+    if(p->nread != p->nwrite || !p->writeopen)
+      break;
+    if(myproc()->killed || nonblock){
+      release(&p->lock);
+      return nonblock ? EAGAIN : -1;
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    src = pipeaddr(p, p->nread, &m);
+    if(m > n - i)
+      m = n - i;
+    if(m > p->nwrite - p->nread)
+      m = p->nwrite - p->nread;
+    memmove(addr + i, src, m);
+    p->nread += m;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  pipewakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
   return i;
 }
+
+// splice() support: instead of copying, pipewbegin() and
+// piperbegin() return part of the ring for the caller to fill
+// or drain, and pipewend() and piperend() finish the job.
+// In between the caller has the write or read side of the
+// pipe to itself, and may sleep.
+
+// Wait for room in p and return the address of the free run
+// at nwrite, setting *n to its length, at most *n.
+// Returns 0 if the reader is gone or the caller was killed.
+char*
+pipewbegin(struct pipe *p, int *n)
+{
+  uint m;
+  char *dst;
+
+  acquire(&p->lock);
+  if(pipetake(p, &p->writing) < 0){
+    release(&p->lock);
+    return 0;
+  }
+  while(p->nwrite == p->nread + PIPESIZE(p)){
+    if(p->readopen == 0 || myproc()->killed){
+      pipegive(&p->writing);
+      release(&p->lock);
+      return 0;
+    }
+    pipewakeup(&p->nread);
+    sleep(&p->nwrite, &p->lock);
+  }
+  dst = pipeaddr(p, p->nwrite, &m);
+  if(m > p->nread + PIPESIZE(p) - p->nwrite)
+    m = p->nread + PIPESIZE(p) - p->nwrite;
+  if(*n > m)
+    *n = m;
+  release(&p->lock);
+  return dst;
+}
+
+// Add the first m bytes of the run from pipewbegin() to p.
+void
+pipewend(struct pipe *p, int m)
+{
+  acquire(&p->lock);
+  p->nwrite += m;
+  pipewakeup(&p->nread);
+  pipegive(&p->writing);
+  release(&p->lock);
+}
+
+// Wait for data in p and return the address of the run at
+// nread, setting *n to its length, at most *n, or to 0 if
+// the writer is gone.  Returns 0 if the caller was killed.
+char*
+piperbegin(struct pipe *p, int *n)
+{
+  uint m;
+  char *src;
+
+  acquire(&p->lock);
+  if(pipetake(p, &p->reading) < 0){
+    release(&p->lock);
+    return 0;
+  }
+  while(p->nread == p->nwrite && p->writeopen){
+    if(myproc()->killed){
+      pipegive(&p->reading);
+      release(&p->lock);
+      return 0;
+    }
+    sleep(&p->nread, &p->lock);
+  }
+  src = pipeaddr(p, p->nread, &m);
+  if(m > p->nwrite - p->nread)
+    m = p->nwrite - p->nread;
+  if(*n > m)
+    *n = m;
+  release(&p->lock);
+  return src;
+}
+
+// Consume the first m bytes of the run from piperbegin(),
+// which may be none, as for tee().
+void
+piperend(struct pipe *p, int m)
+{
+  acquire(&p->lock);
+  p->nread += m;
+  if(m > 0)
+    pipewakeup(&p->nwrite);
+  pipegive(&p->reading);
+  release(&p->lock);
+}
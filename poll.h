@@ -0,0 +1,11 @@
+// A file descriptor for poll() to watch.
+struct pollfd {
+  int fd;         // ignored if negative
+  short events;   // what to wait for
+  short revents;  // what happened
+};
+
+#define POLLIN   0x001  // data to read
+#define POLLOUT  0x004  // room to write
+#define POLLHUP  0x010  // the other end of a pipe is closed
+#define POLLNVAL 0x020  // fd isn't open
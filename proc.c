@@ -24,6 +24,7 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static int waitchild(int, void**);
 
 void removeProcessFromPriorityQueue(int priority, int indexInQueue);
 int findIndexInPriorityQueue(int priority);
@@ -115,6 +116,7 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->pgdir = 0;
   // Edited by Eric Cordts and Jonathan Hsin
   p->priority = 1;
   p->indexInQueue = findIndexInPriorityQueue(p->priority);
@@ -190,7 +192,8 @@ userinit(void)
   p->tf->eip = 0;  // beginning of initcode.S
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  if((p->files = filesalloc(namei("/"))) == 0)
+    panic("userinit: out of memory?");
 
   // this assignment to p->state lets other cores
   // run this process. the acquire forces the above
@@ -201,34 +204,85 @@ userinit(void)
   release(&ptable.lock);
 }
 
+// Count the processes using page table pgdir.
+// The ptable lock must be held.
+static int
+vmusers1(pde_t *pgdir)
+{
+  struct proc *p;
+  int n;
+
+  n = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->state != UNUSED && p->pgdir == pgdir)
+      n++;
+  return n;
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
   uint sz;
+  struct proc *p;
   struct proc *curproc = myproc();
 
+  // Threads share pgdir, and so sz; ptable.lock keeps
+  // two of them from growing it at once.
+  acquire(&ptable.lock);
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0){
+      release(&ptable.lock);
       return -1;
+    }
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Other threads may be running on other CPUs with the
+    // pages still in their TLBs, and there is no way to
+    // flush them there; so only a lone process may shrink.
+    if(vmusers1(curproc->pgdir) > 1 ||
+       (sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0){
+      release(&ptable.lock);
       return -1;
+    }
   }
-  curproc->sz = sz;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->state != UNUSED && p->pgdir == curproc->pgdir)
+      p->sz = sz;
+  release(&ptable.lock);
   switchuvm(curproc);
   return 0;
 }
 
+// Give the current process the user memory pgdir, of size sz,
+// for exec().  Returns the old page table for the caller to
+// free, or 0 if threads made by clone() still use it.  The
+// swap and the count are one step, so that of two threads
+// leaving a page table at once, only the second frees it.
+pde_t*
+setuvm(pde_t *pgdir, uint sz)
+{
+  pde_t *old;
+  struct proc *curproc = myproc();
+
+  acquire(&ptable.lock);
+  old = curproc->pgdir;
+  curproc->pgdir = pgdir;
+  curproc->sz = sz;
+  if(vmusers1(old) > 0)
+    old = 0;
+  release(&ptable.lock);
+  return old;
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *curproc = myproc();
 
@@ -251,10 +305,64 @@ fork(void)
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
-  for(i = 0; i < NOFILE; i++)
-    if(curproc->ofile[i])
-      np->ofile[i] = filedup(curproc->ofile[i]);
-  np->cwd = idup(curproc->cwd);
+  if((np->files = filescopy(curproc->files)) == 0){
+    freevm(np->pgdir);
+    np->pgdir = 0;
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+  np->state = RUNNABLE;
+  release(&ptable.lock);
+
+  return pid;
+}
+
+// Create a thread: a child process that shares the parent's
+// page table, and starts in fn(arg1, arg2) on the page-aligned
+// one-page user stack stack.  It shares the parent's open
+// files and current directory too.
+int
+clone(void (*fn)(void*, void*), void *arg1, void *arg2, void *stack)
+{
+  int pid;
+  uint sp, ustack[3];
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if((uint)stack % PGSIZE != 0 || (uint)stack + PGSIZE > curproc->sz)
+    return -1;
+  if((np = allocproc()) == 0)
+    return -1;
+  np->pgdir = curproc->pgdir;
+  np->sz = curproc->sz;
+  np->parent = curproc;
+  np->ustack = stack;
+  *np->tf = *curproc->tf;
+
+  // Call fn(arg1, arg2), with a fake return PC:
+  // a thread must end with exit().
+  ustack[0] = 0xffffffff;
+  ustack[1] = (uint)arg1;
+  ustack[2] = (uint)arg2;
+  sp = (uint)stack + PGSIZE - sizeof(ustack);
+  if(copyout(np->pgdir, sp, ustack, sizeof(ustack)) < 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->pgdir = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->tf->eip = (uint)fn;
+  np->tf->esp = sp;
+  np->files = filesdup(curproc->files);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -267,6 +375,37 @@ fork(void)
   return pid;
 }
 
+// Create a kernel thread that runs fn() on its own kernel stack,
+// with only the kernel mapped.  fn must never return.
+// The thread is a child of init, like an orphaned process.
+int
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *np;
+
+  if((np = allocproc()) == 0)
+    return -1;
+  if((np->pgdir = setupkvm()) == 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->sz = 0;
+  np->parent = initproc;
+  safestrcpy(np->name, name, sizeof(np->name));
+
+  // allocproc() left trapret's address just above the context
+  // for forkret() to return to; return into fn instead.
+  *(uint*)(np->context + 1) = (uint)fn;
+
+  acquire(&ptable.lock);
+  np->state = RUNNABLE;
+  release(&ptable.lock);
+
+  return np->pid;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -275,23 +414,14 @@ exit(void)
 {
   struct proc *curproc = myproc();
   struct proc *p;
-  int fd;
 
   if(curproc == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd]){
-      fileclose(curproc->ofile[fd]);
-      curproc->ofile[fd] = 0;
-    }
-  }
-
-  begin_op();
-  iput(curproc->cwd);
-  end_op();
-  curproc->cwd = 0;
+  // Close all open files and release the current directory,
+  // unless threads still share them.
+  filesput(curproc->files);
+  curproc->files = 0;
 
   acquire(&ptable.lock);
 
@@ -321,6 +451,24 @@ exit(void)
 // Return -1 if this process has no children.
 int
 wait(void)
+{
+  return waitchild(0, 0);
+}
+
+// Wait for a child thread made by clone() to exit.
+// Return its pid, and its user stack in *stack,
+// or -1 if this process has no child threads.
+int
+join(void **stack)
+{
+  return waitchild(1, stack);
+}
+
+// Wait for a child to exit and return its pid: a process,
+// or, if thread is set, a thread sharing our page table,
+// whose user stack is returned in *stack.
+static int
+waitchild(int thread, void **stack)
 {
   struct proc *p;
   int havekids, pid;
@@ -331,7 +479,7 @@ wait(void)
     // Scan through table looking for exited children.
     havekids = 0;
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
+      if(p->parent != curproc || (p->pgdir == curproc->pgdir) != thread)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
@@ -339,7 +487,12 @@ wait(void)
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
-        freevm(p->pgdir);
+        if(thread)
+          *stack = p->ustack;
+        if(vmusers1(p->pgdir) == 1)
+          freevm(p->pgdir);
+        p->pgdir = 0;
+        p->ustack = 0;
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
@@ -668,6 +821,68 @@ wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// Futexes.  A process waits on a user word by sleeping on its
+// physical address pa, so processes that map the same page
+// meet on the same channel.  User pages are never kernel
+// objects, so pa can't clash with a kernel channel.
+
+// Return the kernel address of the current process's aligned
+// user word uaddr, or 0 if it isn't mapped.  The ptable lock
+// must be held, so that a thread's growproc() can't unmap the
+// page until the caller is done with the word.
+static int*
+futexword(int *uaddr)
+{
+  char *ka;
+
+  if((ka = uva2ka(myproc()->pgdir, (char*)uaddr)) == 0)
+    return 0;
+  return (int*)(ka + (uint)uaddr % PGSIZE);
+}
+
+// Sleep on the user word uaddr if it still holds val.
+// Checking it under ptable.lock means a futexwake() after
+// the word changes can't be missed.
+// Returns -1 if it didn't hold val or the process was killed.
+int
+futexwait(int *uaddr, int val)
+{
+  int *w;
+
+  acquire(&ptable.lock);
+  if((w = futexword(uaddr)) == 0 || *w != val){
+    release(&ptable.lock);
+    return -1;
+  }
+  sleep((void*)V2P(w), &ptable.lock);
+  release(&ptable.lock);
+  return myproc()->killed ? -1 : 0;
+}
+
+// Wake up to n processes waiting on the user word uaddr;
+// return how many, or -1 if uaddr isn't mapped.
+int
+futexwake(int *uaddr, int n)
+{
+  struct proc *p;
+  int *w, woken;
+
+  woken = 0;
+  acquire(&ptable.lock);
+  if((w = futexword(uaddr)) == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  for(p = ptable.proc; p < &ptable.proc[NPROC] && woken < n; p++){
+    if(p->state == SLEEPING && p->chan == (void*)V2P(w)){
+      p->state = RUNNABLE;
+      woken++;
+    }
+  }
+  release(&ptable.lock);
+  return woken;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
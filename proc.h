@@ -46,9 +46,11 @@ struct proc {
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct files *files;         // Open files and current directory
+  struct file *fdref[2];       // Files argfd() holds for this call
+  int nfdref;
   char name[16];               // Process name (debugging)
+  void *ustack;                // User stack given to clone(), or 0
   // Additions by Jonathan Hsin and Eric Cordts
   int priority; // ranges from 0-2, default of 1
   int indexInQueue; // the index that this process occupies in its priority queue
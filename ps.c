@@ -2,11 +2,26 @@
 #include "stat.h"
 #include "user.h"
 #include "fcntl.h"
+#include "param.h"
+#include "memlayout.h"
+#include "vdso.h"
 
 
 int main(int argc, char **argv)
 { 
+	volatile struct vdso *v = (struct vdso*)VDSO;
+	uint t, b;
+	int i;
+
 	ps();
+	// Per-CPU load since boot, from the vDSO page.
+	for(i = 0; i < NCPU; i++){
+		t = v->cpu[i].ticks;
+		b = v->cpu[i].busy;
+		if(t > 0)
+			printf(1, "cpu%d\t%d%% busy\n", i,
+			       t < 100 ? b*100/t : b/(t/100));
+	}
 	exit();
     
 }
\ No newline at end of file
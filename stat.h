@@ -9,3 +9,14 @@ struct stat {
   short nlink; // Number of links to file
   uint size;   // Size of file in bytes
 };
+
+// Log statistics, filled in by logstat().
+struct logstat {
+  uint ncommit;     // Transactions committed
+  uint nlogged;     // Blocks written to the log
+  uint nabsorbed;   // Writes absorbed by a block already logged
+  uint nticks;      // Ticks spent in commit
+  uint lastlogged;  // The same, for the last transaction
+  uint lastabsorbed;
+  uint lastticks;
+};
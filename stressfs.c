@@ -12,20 +12,43 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "param.h"
+#include "memlayout.h"
+#include "vdso.h"
+
+// Add up, from the vDSO page, the timer ticks all CPUs have
+// seen and how many of them found a process running.
+void
+cpuload(uint *ticks, uint *busy)
+{
+  volatile struct vdso *v = (struct vdso*)VDSO;
+  int i;
+
+  *ticks = *busy = 0;
+  for(i = 0; i < NCPU; i++){
+    *ticks += v->cpu[i].ticks;
+    *busy += v->cpu[i].busy;
+  }
+}
 
 int
 main(int argc, char *argv[])
 {
-  int fd, i;
+  int fd, i, me, start;
+  uint t0, b0, t1, b1;
   char path[] = "stressfs0";
   char data[512];
+  struct logstat ls;
 
   printf(1, "stressfs starting\n");
   memset(data, 'a', sizeof(data));
+  start = uptime();
+  cpuload(&t0, &b0);
 
   for(i = 0; i < 4; i++)
     if(fork() > 0)
       break;
+  me = i;
 
   printf(1, "write %d\n", i);
 
@@ -45,5 +68,18 @@ main(int argc, char *argv[])
 
   wait();
 
+  // Each process waits for the one it forked, so the
+  // first one finishes last.
+  if(me == 0){
+    // The CPUs are idle, not busy, while the disk works
+    // by DMA, so a lower busy share means less copying.
+    cpuload(&t1, &b1);
+    printf(1, "stressfs: %d ticks, CPUs %d%% busy\n", uptime() - start,
+           t1 > t0 ? (b1 - b0)*100 / (t1 - t0) : 0);
+    if(logstat(&ls) == 0)
+      printf(1, "log: %d commits, %d blocks logged, %d absorbed, %d ticks\n",
+             ls.ncommit, ls.nlogged, ls.nabsorbed, ls.nticks);
+  }
+
   exit();
 }
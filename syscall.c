@@ -105,6 +105,20 @@ extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_renice(void);
 extern int sys_ps(void);
+extern int sys_logstat(void);
+extern int sys_fcntl(void);
+extern int sys_splice(void);
+extern int sys_tee(void);
+extern int sys_copy_file_range(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_poll(void);
+extern int sys_pipe2(void);
+extern int sys_futex(void);
+extern int sys_clone(void);
+extern int sys_join(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -130,6 +144,20 @@ static int (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_renice]  sys_renice,
 [SYS_ps]      sys_ps,
+[SYS_logstat] sys_logstat,
+[SYS_fcntl]   sys_fcntl,
+[SYS_splice]  sys_splice,
+[SYS_tee]     sys_tee,
+[SYS_copy_file_range] sys_copy_file_range,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_poll]    sys_poll,
+[SYS_pipe2]   sys_pipe2,
+[SYS_futex]   sys_futex,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
 };
 
 void
@@ -141,6 +169,7 @@ syscall(void)
   num = curproc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     curproc->tf->eax = syscalls[num]();
+    argfdput();
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
@@ -21,4 +21,18 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_renice 22
-#define SYS_ps     23
\ No newline at end of file
+#define SYS_ps     23
+#define SYS_logstat 24
+#define SYS_fcntl  25
+#define SYS_splice 26
+#define SYS_tee    27
+#define SYS_copy_file_range 28
+#define SYS_readv  29
+#define SYS_writev 30
+#define SYS_pread  31
+#define SYS_pwrite 32
+#define SYS_poll   33
+#define SYS_pipe2  34
+#define SYS_futex  35
+#define SYS_clone  36
+#define SYS_join   37
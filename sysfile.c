@@ -15,19 +15,37 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "poll.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// If clone() threads share the file table, one of them could
+// close fd while the call uses the file, so argfd() holds a
+// reference until argfdput() drops it when the call returns.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
   int fd;
   struct file *f;
+  struct proc *curproc = myproc();
+  struct files *fs = curproc->files;
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  acquire(&fs->lock);
+  if((f = fs->ofile[fd]) == 0){
+    release(&fs->lock);
     return -1;
+  }
+  if(fs->ref > 1){
+    if(curproc->nfdref == NELEM(curproc->fdref))
+      panic("argfd");
+    curproc->fdref[curproc->nfdref++] = filedup(f);
+  }
+  release(&fs->lock);
   if(pfd)
     *pfd = fd;
   if(pf)
@@ -35,23 +53,68 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
+// Return the file open as fd with a new reference,
+// or 0 if there is none.
+static struct file*
+fdget(int fd)
+{
+  struct file *f;
+  struct files *fs = myproc()->files;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&fs->lock);
+  if((f = fs->ofile[fd]) != 0)
+    filedup(f);
+  release(&fs->lock);
+  return f;
+}
+
+// Drop the references argfd() took for this system call.
+void
+argfdput(void)
+{
+  struct proc *curproc = myproc();
+
+  while(curproc->nfdref > 0)
+    fileclose(curproc->fdref[--curproc->nfdref]);
+}
+
 // Allocate a file descriptor for the given file.
 // Takes over file reference from caller on success.
 static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *curproc = myproc();
+  struct files *fs = myproc()->files;
 
+  acquire(&fs->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd] == 0){
-      curproc->ofile[fd] = f;
+    if(fs->ofile[fd] == 0){
+      fs->ofile[fd] = f;
+      release(&fs->lock);
       return fd;
     }
   }
+  release(&fs->lock);
   return -1;
 }
 
+// Remove fd from the file table, and return its file
+// for the caller to close, or 0 if fd wasn't open.
+static struct file*
+fdfree(int fd)
+{
+  struct file *f;
+  struct files *fs = myproc()->files;
+
+  acquire(&fs->lock);
+  if((f = fs->ofile[fd]) != 0)
+    fs->ofile[fd] = 0;
+  release(&fs->lock);
+  return f;
+}
+
 int
 sys_dup(void)
 {
@@ -78,6 +141,115 @@ sys_read(void)
   return fileread(f, p, n);
 }
 
+// Fetch the iovec array argument n, with cnt segments,
+// into iov, checking that each segment lies within the
+// process address space.
+static int
+argiov(int n, struct iovec *iov, int cnt)
+{
+  char *p;
+  int i;
+  uint sz;
+
+  if(cnt < 0 || cnt > UIO_MAXIOV || argptr(n, &p, cnt*sizeof(*iov)) < 0)
+    return -1;
+  memmove(iov, p, cnt*sizeof(*iov));
+  sz = myproc()->sz;
+  for(i = 0; i < cnt; i++){
+    if(iov[i].len < 0 || (uint)iov[i].base >= sz ||
+       (uint)iov[i].base + iov[i].len > sz)
+      return -1;
+  }
+  return 0;
+}
+
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[UIO_MAXIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, iov, cnt) < 0)
+    return -1;
+  return filereadv(f, iov, cnt);
+}
+
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[UIO_MAXIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, iov, cnt) < 0)
+    return -1;
+  return filewritev(f, iov, cnt);
+}
+
+int
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// Move data from fd in to fd out inside the kernel;
+// one of them must be a pipe.
+int
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(in, out, n, 0);
+}
+
+// Copy data from pipe in to pipe out, leaving it in in.
+int
+sys_tee(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(in, out, n, 1);
+}
+
+// Copy data from fd in to fd out inside the kernel.
+int
+sys_copy_file_range(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filecopy(in, out, n);
+}
+
 int
 sys_write(void)
 {
@@ -96,9 +268,8 @@ sys_close(void)
   int fd;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(argint(0, &fd) < 0 || fd < 0 || fd >= NOFILE || (f = fdfree(fd)) == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -114,12 +285,24 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+int
+sys_logstat(void)
+{
+  struct logstat *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  logstat(st);
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 int
 sys_link(void)
 {
   char name[DIRSIZ], *new, *old;
   struct inode *dp, *ip;
+  int r;
 
   if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
     return -1;
@@ -141,10 +324,11 @@ sys_link(void)
   iupdate(ip);
   iunlock(ip);
 
+  r = -1;
   if((dp = nameiparent(new, name)) == 0)
     goto bad;
   ilock(dp);
-  if(dp->dev != ip->dev || dirlink(dp, name, ip->inum) < 0){
+  if(dp->dev != ip->dev || (r = dirlink(dp, name, ip->inum)) < 0){
     iunlockput(dp);
     goto bad;
   }
@@ -161,7 +345,7 @@ bad:
   iupdate(ip);
   iunlockput(ip);
   end_op();
-  return -1;
+  return r;
 }
 
 // Is the directory dp empty except for "." and ".." ?
@@ -218,6 +402,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheforget(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -238,12 +423,14 @@ bad:
   return -1;
 }
 
+// Create path, returning it locked, or 0 with the error in *err.
 static struct inode*
-create(char *path, short type, short major, short minor)
+create(char *path, short type, short major, short minor, int *err)
 {
   struct inode *ip, *dp;
   char name[DIRSIZ];
 
+  *err = -1;
   if((dp = nameiparent(path, name)) == 0)
     return 0;
   ilock(dp);
@@ -274,8 +461,18 @@ create(char *path, short type, short major, short minor)
       panic("create dots");
   }
 
-  if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+  if((*err = dirlink(dp, name, ip->inum)) < 0){
+    // dp is full; free ip again.
+    if(type == T_DIR){
+      dp->nlink--;
+      iupdate(dp);
+    }
+    ip->nlink = 0;
+    iupdate(ip);
+    iunlockput(ip);
+    iunlockput(dp);
+    return 0;
+  }
 
   iunlockput(dp);
 
@@ -286,7 +483,7 @@ int
 sys_open(void)
 {
   char *path;
-  int fd, omode;
+  int err, fd, omode;
   struct file *f;
   struct inode *ip;
 
@@ -296,10 +493,10 @@ sys_open(void)
   begin_op();
 
   if(omode & O_CREATE){
-    ip = create(path, T_FILE, 0, 0);
+    ip = create(path, T_FILE, 0, 0, &err);
     if(ip == 0){
       end_op();
-      return -1;
+      return err;
     }
   } else {
     if((ip = namei(path)) == 0){
@@ -307,7 +504,7 @@ sys_open(void)
       return -1;
     }
     ilock(ip);
-    if(ip->type == T_DIR && omode != O_RDONLY){
+    if(ip->type == T_DIR && (omode & (O_WRONLY|O_RDWR))){
       iunlockput(ip);
       end_op();
       return -1;
@@ -329,6 +526,7 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
   return fd;
 }
 
@@ -337,11 +535,13 @@ sys_mkdir(void)
 {
   char *path;
   struct inode *ip;
+  int err;
 
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  err = -1;
+  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0, &err)) == 0){
     end_op();
-    return -1;
+    return err;
   }
   iunlockput(ip);
   end_op();
@@ -353,15 +553,16 @@ sys_mknod(void)
 {
   struct inode *ip;
   char *path;
-  int major, minor;
+  int err, major, minor;
 
   begin_op();
+  err = -1;
   if((argstr(0, &path)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
-     (ip = create(path, T_DEV, major, minor)) == 0){
+     (ip = create(path, T_DEV, major, minor, &err)) == 0){
     end_op();
-    return -1;
+    return err;
   }
   iunlockput(ip);
   end_op();
@@ -372,8 +573,8 @@ int
 sys_chdir(void)
 {
   char *path;
-  struct inode *ip;
-  struct proc *curproc = myproc();
+  struct inode *ip, *old;
+  struct files *fs = myproc()->files;
   
   begin_op();
   if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
@@ -387,9 +588,12 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(curproc->cwd);
+  acquire(&fs->lock);
+  old = fs->cwd;
+  fs->cwd = ip;
+  release(&fs->lock);
+  iput(old);
   end_op();
-  curproc->cwd = ip;
   return 0;
 }
 
@@ -419,21 +623,21 @@ sys_exec(void)
   return exec(path, argv);
 }
 
-int
-sys_pipe(void)
+// Create a pipe, with O_NONBLOCK from flags, and put
+// its read and write fds in fd[0] and fd[1].
+static int
+pipefds(int *fd, int flags)
 {
-  int *fd;
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
-    return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
+  rf->nonblock = wf->nonblock = (flags & O_NONBLOCK) != 0;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      myproc()->ofile[fd0] = 0;
+      fdfree(fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -442,3 +646,106 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_pipe(void)
+{
+  int *fd;
+
+  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+    return -1;
+  return pipefds(fd, 0);
+}
+
+int
+sys_pipe2(void)
+{
+  int *fd, flags;
+
+  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0 || argint(1, &flags) < 0)
+    return -1;
+  return pipefds(fd, flags);
+}
+
+// Get or set a file's flags, or the size of a pipe's buffer.
+int
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  switch(cmd){
+  case F_GETFL:
+    arg = f->readable && f->writable ? O_RDWR :
+          f->writable ? O_WRONLY : O_RDONLY;
+    return f->nonblock ? arg | O_NONBLOCK : arg;
+  case F_SETFL:
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  }
+  if(f->type != FD_PIPE)
+    return -1;
+  switch(cmd){
+  case F_GETPIPE_SZ:
+    return pipesize(f->pipe);
+  case F_SETPIPE_SZ:
+    return piperesize(f->pipe, arg);
+  }
+  return -1;
+}
+
+// Wait until one of the nfds files in fds is ready for
+// what it asks, or for timeout ticks; -1 waits forever.
+// Returns the number of entries with revents set.
+int
+sys_poll(void)
+{
+  struct pollfd *fds;
+  struct file *f[NOFILE];
+  int nfds, timeout, i, n;
+  uint gen, t0;
+
+  if(argint(1, &nfds) < 0 || nfds < 0 || nfds > NOFILE ||
+     argptr(0, (void*)&fds, nfds*sizeof(*fds)) < 0 ||
+     argint(2, &timeout) < 0)
+    return -1;
+  // Hold the files while waiting, in case a thread
+  // sharing the file table closes them.
+  for(i = 0; i < nfds; i++)
+    f[i] = fdget(fds[i].fd);
+  acquire(&tickslock);
+  t0 = ticks;
+  release(&tickslock);
+  for(;;){
+    gen = pollgen();
+    for(i = n = 0; i < nfds; i++){
+      if(fds[i].fd < 0)
+        fds[i].revents = 0;  // entry switched off
+      else if(f[i] == 0)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = filepoll(f[i]) & (fds[i].events | POLLHUP);
+      if(fds[i].revents)
+        n++;
+    }
+    if(n > 0 || timeout == 0)
+      break;
+    if(timeout > 0){
+      acquire(&tickslock);
+      i = ticks - t0 >= timeout;
+      release(&tickslock);
+      if(i)
+        break;
+    }
+    if(pollwait(gen, timeout > 0) < 0){
+      n = -1;
+      break;
+    }
+  }
+  for(i = 0; i < nfds; i++)
+    if(f[i])
+      fileclose(f[i]);
+  return n;
+}
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "futex.h"
 
 int
 sys_fork(void)
@@ -13,6 +14,28 @@ sys_fork(void)
   return fork();
 }
 
+int
+sys_clone(void)
+{
+  int fn, arg1, arg2;
+  char *stack;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg1) < 0 || argint(2, &arg2) < 0 ||
+     argptr(3, &stack, PGSIZE) < 0)
+    return -1;
+  return clone((void(*)(void*, void*))fn, (void*)arg1, (void*)arg2, stack);
+}
+
+int
+sys_join(void)
+{
+  void **stack;
+
+  if(argptr(0, (void*)&stack, sizeof(*stack)) < 0)
+    return -1;
+  return join(stack);
+}
+
 int
 sys_exit(void)
 {
@@ -120,3 +143,25 @@ sys_ps(void)
   proc_ps();
   return 0;
 }
+
+// Wait on or wake the user word at addr, keyed on its
+// physical address.
+int
+sys_futex(void)
+{
+  int *addr, op, val;
+
+  if(argptr(0, (void*)&addr, sizeof(*addr)) < 0 ||
+     argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  // An aligned word doesn't straddle two pages.
+  if((uint)addr % sizeof(*addr) != 0)
+    return -1;
+  switch(op){
+  case FUTEX_WAIT:
+    return futexwait(addr, val);
+  case FUTEX_WAKE:
+    return futexwake(addr, val);
+  }
+  return -1;
+}
@@ -7,10 +7,12 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "vdso.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
+extern void sysenter(void);  // in trapasm.S
 struct spinlock tickslock;
 uint ticks;
 
@@ -57,6 +59,7 @@ trap(struct trapframe *tf)
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
+      vdso->ticks = ticks;
       
       // Edited by Eric Cordts and Jonathan Hsin for EECE7376
       if(ticks % 20 == 0)
@@ -68,7 +71,11 @@ trap(struct trapframe *tf)
 
       wakeup(&ticks);
       release(&tickslock);
+      polltick();
     }
+    vdso->cpu[cpuid()].ticks++;
+    if(myproc())
+      vdso->cpu[cpuid()].busy++;
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -93,8 +100,23 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_DEBUG:
+    // SYSENTER leaves FL_TF alone, so a single-stepping
+    // process traps on the first instruction of sysenter.
+    if((tf->cs&3) == 0 && tf->eip == (uint)sysenter){
+      tf->eflags &= ~FL_TF;
+      break;
+    }
+    // fall through
+
   //PAGEBREAK: 13
   default:
+    // The virtio disk's PCI interrupt line is only known at run time.
+    if(virtioirq != 0 && tf->trapno == T_IRQ0 + virtioirq){
+      virtiointr();
+      lapiceoi();
+      break;
+    }
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
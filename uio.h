@@ -0,0 +1,7 @@
+// A segment of memory for readv() and writev().
+struct iovec {
+  void *base;
+  int len;
+};
+
+#define UIO_MAXIOV 16  // most segments in one readv() or writev()
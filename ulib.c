@@ -3,6 +3,10 @@
 #include "fcntl.h"
 #include "user.h"
 #include "x86.h"
+#include "futex.h"
+#include "param.h"
+#include "memlayout.h"
+#include "vdso.h"
 
 char*
 strcpy(char *s, const char *t)
@@ -104,3 +108,30 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// A lock is an int: 0 if free, 1 if held, and 2 if held
+// and someone may be waiting for it.  Only a contended
+// acquire or release enters the kernel.
+void
+lock_acquire(int *l)
+{
+  if(xchg((uint*)l, 1) == 0)
+    return;
+  while(xchg((uint*)l, 2) != 0)
+    futex(l, FUTEX_WAIT, 2);
+}
+
+void
+lock_release(int *l)
+{
+  if(xchg((uint*)l, 0) == 2)
+    futex(l, FUTEX_WAKE, 1);
+}
+
+// The kernel keeps the tick count in the vDSO page,
+// so there is no need to trap for it.
+int
+uptime(void)
+{
+  return ((volatile struct vdso*)VDSO)->ticks;
+}
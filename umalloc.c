@@ -2,6 +2,7 @@
 #include "stat.h"
 #include "user.h"
 #include "param.h"
+#include "mmu.h"
 
 // Memory allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
@@ -88,3 +89,36 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+// Threads live here rather than in ulib.c because their stacks
+// come from malloc(), which forktest does not link in.
+
+// Run fn(arg1, arg2) in a new thread, on a page of the heap
+// for its stack.  The word below the stack points back at
+// the block malloc() returned, for thread_join() to free.
+int
+thread_create(void (*fn)(void*, void*), void *arg1, void *arg2)
+{
+  char *mem, *stack;
+  int pid;
+
+  if((mem = malloc(2*PGSIZE + sizeof(mem))) == 0)
+    return -1;
+  stack = (char*)PGROUNDUP((uint)mem + sizeof(mem));
+  ((char**)stack)[-1] = mem;
+  if((pid = clone(fn, arg1, arg2, stack)) < 0)
+    free(mem);
+  return pid;
+}
+
+// Wait for a thread to exit, free its stack and return its pid.
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) >= 0)
+    free(((char**)stack)[-1]);
+  return pid;
+}
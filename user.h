@@ -1,4 +1,7 @@
 struct stat;
+struct logstat;
+struct iovec;
+struct pollfd;
 struct rtcdate;
 
 // system calls
@@ -25,6 +28,20 @@ int sleep(int);
 int uptime(void);
 int renice(int, int); // parameters are int priority, int pid
 int ps(void);
+int logstat(struct logstat*);
+int fcntl(int, int, int);
+int splice(int, int, int);
+int tee(int, int, int);
+int copy_file_range(int, int, int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, void*, int, int);
+int poll(struct pollfd*, int, int);
+int pipe2(int*, int);
+int futex(int*, int, int);
+int clone(void(*)(void*, void*), void*, void*, void*);
+int join(void**);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -39,3 +56,7 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+void lock_acquire(int*);
+void lock_release(int*);
+int thread_create(void(*)(void*, void*), void*, void*);
+int thread_join(void);
@@ -4,9 +4,13 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "poll.h"
+#include "futex.h"
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "vdso.h"
 
 char buf[8192];
 char name[3];
@@ -184,6 +188,9 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// Enough blocks to reach the doubly-indirect range.
+#define NBIG (NDIRECT + 2*NINDIRECT)
+
 void
 writetest1(void)
 {
@@ -197,7 +204,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +224,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBIG){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -241,6 +248,274 @@ writetest1(void)
   printf(stdout, "big files ok\n");
 }
 
+// Add up, from the vDSO page, the timer ticks all CPUs have
+// seen and how many of them found a process running.
+void
+cpuload(uint *ticks, uint *busy)
+{
+  volatile struct vdso *v = (struct vdso*)VDSO;
+  int i;
+
+  *ticks = *busy = 0;
+  for(i = 0; i < NCPU; i++){
+    *ticks += v->cpu[i].ticks;
+    *busy += v->cpu[i].busy;
+  }
+}
+
+// Percentage of the CPU ticks since cpuload() returned
+// ticks and busy that found a process running.
+int
+cpubusy(uint ticks, uint busy)
+{
+  uint t, b;
+
+  cpuload(&t, &b);
+  return t > ticks ? (b - busy)*100 / (t - ticks) : 0;
+}
+
+// write and read back a multi-megabyte file, which needs
+// the doubly-indirect blocks, and report the throughput
+// and how busy the CPUs were meanwhile.
+void
+hugefile(void)
+{
+  int fd, i, t0;
+  uint ct, cb;
+  enum { NHUGE = 4*1024*1024 / sizeof(buf) };
+
+  printf(stdout, "huge file test\n");
+
+  unlink("huge");
+  fd = open("huge", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat huge failed!\n");
+    exit();
+  }
+  t0 = uptime();
+  cpuload(&ct, &cb);
+  for(i = 0; i < NHUGE; i++){
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(stdout, "error: write huge file failed at %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  printf(stdout, "huge file: wrote %d KB in %d ticks, CPUs %d%% busy\n",
+         NHUGE*sizeof(buf)/1024, uptime() - t0, cpubusy(ct, cb));
+
+  fd = open("huge", O_RDONLY);
+  if(fd < 0){
+    printf(stdout, "error: open huge failed!\n");
+    exit();
+  }
+  t0 = uptime();
+  cpuload(&ct, &cb);
+  for(i = 0; i < NHUGE; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(stdout, "error: read huge file failed at %d\n", i);
+      exit();
+    }
+    if(((int*)buf)[0] != i){
+      printf(stdout, "error: huge file chunk %d is %d\n", i, ((int*)buf)[0]);
+      exit();
+    }
+  }
+  if(read(fd, buf, 1) != 0){
+    printf(stdout, "error: huge file too long\n");
+    exit();
+  }
+  close(fd);
+  printf(stdout, "huge file: read %d KB in %d ticks, CPUs %d%% busy\n",
+         NHUGE*sizeof(buf)/1024, uptime() - t0, cpubusy(ct, cb));
+
+  if(unlink("huge") < 0){
+    printf(stdout, "error: unlink huge failed\n");
+    exit();
+  }
+  printf(stdout, "huge file ok\n");
+}
+
+// writev() three segments, patch them with pwrite(),
+// and read them back with pread() and readv().
+void
+iovtest(void)
+{
+  int fd, i;
+  struct iovec iov[3];
+  char a[100], b[600], c[1];
+
+  printf(stdout, "iov test\n");
+  memset(a, 'a', sizeof(a));
+  memset(b, 'b', sizeof(b));
+  c[0] = 'c';
+  iov[0].base = a; iov[0].len = sizeof(a);
+  iov[1].base = b; iov[1].len = sizeof(b);
+  iov[2].base = c; iov[2].len = sizeof(c);
+  fd = open("iov", O_CREATE|O_RDWR);
+  if(fd < 0 || writev(fd, iov, 3) != 701){
+    printf(stdout, "error: writev failed\n");
+    exit();
+  }
+  if(pwrite(fd, "xy", 2, 99) != 2 || pread(fd, buf, 3, 98) != 3 ||
+     buf[0] != 'a' || buf[1] != 'x' || buf[2] != 'y'){
+    printf(stdout, "error: pwrite/pread failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("iov", O_RDONLY);
+  if(readv(fd, iov, 3) != 701){
+    printf(stdout, "error: readv failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(b); i++){
+    if(b[i] != (i == 0 ? 'y' : 'b')){
+      printf(stdout, "error: readv got %c at %d\n", b[i], i);
+      exit();
+    }
+  }
+  if(a[99] != 'x' || c[0] != 'c' || read(fd, buf, 1) != 0){
+    printf(stdout, "error: readv got the wrong data\n");
+    exit();
+  }
+  close(fd);
+  unlink("iov");
+  printf(stdout, "iov ok\n");
+}
+
+// Copy a 1 MB file with a read/write loop and with
+// copy_file_range(), and compare the times.
+void
+copybench(void)
+{
+  int fd0, fd1, i, n, t0, t1;
+  struct stat st;
+  enum { NCOPY = 1024*1024 / sizeof(buf) };
+
+  printf(stdout, "copy test\n");
+  fd0 = open("cpsrc", O_CREATE|O_RDWR);
+  if(fd0 < 0){
+    printf(stdout, "error: creat cpsrc failed!\n");
+    exit();
+  }
+  for(i = 0; i < NCOPY; i++){
+    ((int*)buf)[0] = i;
+    if(write(fd0, buf, sizeof(buf)) != sizeof(buf)){
+      printf(stdout, "error: write cpsrc failed\n");
+      exit();
+    }
+  }
+  close(fd0);
+
+  fd0 = open("cpsrc", O_RDONLY);
+  fd1 = open("cpdst1", O_CREATE|O_WRONLY);
+  t0 = uptime();
+  while((n = read(fd0, buf, sizeof(buf))) > 0)
+    if(write(fd1, buf, n) != n)
+      break;
+  t0 = uptime() - t0;
+  close(fd0);
+  close(fd1);
+
+  fd0 = open("cpsrc", O_RDONLY);
+  fd1 = open("cpdst2", O_CREATE|O_WRONLY);
+  t1 = uptime();
+  while((n = copy_file_range(fd0, fd1, NCOPY*sizeof(buf))) > 0)
+    ;
+  t1 = uptime() - t1;
+  close(fd0);
+  close(fd1);
+  if(n < 0){
+    printf(stdout, "error: copy_file_range failed\n");
+    exit();
+  }
+
+  fd1 = open("cpdst2", O_RDONLY);
+  if(fstat(fd1, &st) < 0 || st.size != NCOPY*sizeof(buf)){
+    printf(stdout, "error: cpdst2 has the wrong size\n");
+    exit();
+  }
+  for(i = 0; i < NCOPY; i++){
+    if(read(fd1, buf, sizeof(buf)) != sizeof(buf) || ((int*)buf)[0] != i){
+      printf(stdout, "error: cpdst2 chunk %d is wrong\n", i);
+      exit();
+    }
+  }
+  close(fd1);
+  printf(stdout, "copy: read/write %d ticks, copy_file_range %d ticks\n",
+         t0, t1);
+  unlink("cpsrc");
+  unlink("cpdst1");
+  unlink("cpdst2");
+  printf(stdout, "copy ok\n");
+}
+
+// time creating and writing small files once the disk
+// is nearly full, where finding free blocks is slowest.
+void
+nearfull(void)
+{
+  int fd, i, j, t0;
+  char name[8];
+  enum { NFILL = 8*1024*1024 / sizeof(buf), NF = 40, NFBLK = 2 };
+
+  printf(stdout, "nearfull test\n");
+
+  unlink("filler");
+  fd = open("filler", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat filler failed!\n");
+    exit();
+  }
+  memset(buf, 'f', sizeof(buf));
+  for(i = 0; i < NFILL; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(stdout, "error: write filler failed at %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+
+  name[0] = 'n';
+  name[1] = 'f';
+  name[4] = '\0';
+  t0 = uptime();
+  for(i = 0; i < NF; i++){
+    name[2] = '0' + i/10;
+    name[3] = '0' + i%10;
+    fd = open(name, O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf(stdout, "error: creat %s failed\n", name);
+      exit();
+    }
+    for(j = 0; j < NFBLK; j++){
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf(stdout, "error: write %s failed\n", name);
+        exit();
+      }
+    }
+    close(fd);
+  }
+  printf(stdout, "nearfull: created %d files, %d KB in %d ticks\n",
+         NF, NF*NFBLK*sizeof(buf)/1024, uptime() - t0);
+
+  for(i = 0; i < NF; i++){
+    name[2] = '0' + i/10;
+    name[3] = '0' + i%10;
+    if(unlink(name) < 0){
+      printf(stdout, "error: unlink %s failed\n", name);
+      exit();
+    }
+  }
+  if(unlink("filler") < 0){
+    printf(stdout, "error: unlink filler failed\n");
+    exit();
+  }
+  printf(stdout, "nearfull ok\n");
+}
+
 void
 createtest(void)
 {
@@ -354,6 +629,411 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// Time moving 4 MB through a pipe with the default buffer,
+// then with the largest one.
+void
+pipebw(void)
+{
+  int fds[2], pid, n, i, total, size, t0;
+  enum { NPIPEBW = 4*1024*1024 };
+
+  printf(1, "pipe bandwidth test\n");
+  for(i = 0; i < 2; i++){
+    if(pipe(fds) != 0){
+      printf(1, "pipe() failed\n");
+      exit();
+    }
+    if(i == 1 && fcntl(fds[1], F_SETPIPE_SZ, 64*1024) != 64*1024){
+      printf(1, "pipebw: F_SETPIPE_SZ failed\n");
+      exit();
+    }
+    size = fcntl(fds[0], F_GETPIPE_SZ, 0);
+    t0 = uptime();
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork() failed\n");
+      exit();
+    }
+    if(pid == 0){
+      close(fds[0]);
+      for(total = 0; total < NPIPEBW; total += sizeof(buf)){
+        if(write(fds[1], buf, sizeof(buf)) != sizeof(buf)){
+          printf(1, "pipebw: write failed\n");
+          exit();
+        }
+      }
+      exit();
+    }
+    close(fds[1]);
+    total = 0;
+    while((n = read(fds[0], buf, sizeof(buf))) > 0)
+      total += n;
+    close(fds[0]);
+    wait();
+    if(total != NPIPEBW){
+      printf(1, "pipebw: read %d bytes\n", total);
+      exit();
+    }
+    printf(1, "pipe bandwidth: %d KB through a %d byte pipe in %d ticks\n",
+           NPIPEBW/1024, size, uptime() - t0);
+  }
+  printf(1, "pipe bandwidth ok\n");
+}
+
+// Move a file through two pipes with splice() and tee(),
+// and check both copies.
+void
+splicetest(void)
+{
+  int fd, p1[2], p2[2], i, n;
+
+  printf(1, "splice test\n");
+  fd = open("splicein", O_CREATE|O_RDWR);
+  for(i = 0; i < 1000; i++)
+    buf[i] = i;
+  if(fd < 0 || write(fd, buf, 1000) != 1000){
+    printf(1, "splice: create splicein failed\n");
+    exit();
+  }
+  close(fd);
+
+  if(pipe(p1) != 0 || pipe(p2) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  fd = open("splicein", O_RDONLY);
+  for(i = 0; i < 1000; i += n){
+    if((n = splice(fd, p1[1], 1000 - i)) <= 0){
+      printf(1, "splice: file to pipe failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  // The data is one run of p1's ring, so one tee() copies it all.
+  if(tee(p1[0], p2[1], 1000) != 1000){
+    printf(1, "splice: tee failed\n");
+    exit();
+  }
+  close(p1[1]);
+  close(p2[1]);
+
+  fd = open("spliceout", O_CREATE|O_RDWR);
+  for(i = 0; (n = splice(p1[0], fd, 1000)) > 0; i += n)
+    ;
+  close(fd);
+  if(n < 0 || i != 1000){
+    printf(1, "splice: pipe to file moved %d\n", i);
+    exit();
+  }
+  fd = open("spliceout", O_RDONLY);
+  if(read(fd, buf, sizeof(buf)) != 1000 || read(p2[0], buf+1000, 1000) != 1000){
+    printf(1, "splice: short copy\n");
+    exit();
+  }
+  for(i = 0; i < 1000; i++){
+    if(buf[i] != (char)i || buf[1000+i] != (char)i){
+      printf(1, "splice: wrong data at %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  close(p1[0]);
+  close(p2[0]);
+  unlink("splicein");
+  unlink("spliceout");
+  printf(1, "splice ok\n");
+}
+
+// Wait on two pipes with poll(), while a child writes
+// to the second one.
+void
+polltest(void)
+{
+  int a[2], b[2], pid, n;
+  struct pollfd fds[2];
+
+  printf(1, "poll test\n");
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  fds[0].fd = a[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = b[0];
+  fds[1].events = POLLIN;
+  if(poll(fds, 2, 2) != 0){
+    printf(1, "poll: ready with no data\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork() failed\n");
+    exit();
+  }
+  if(pid == 0){
+    sleep(2);
+    write(b[1], "x", 1);
+    exit();
+  }
+  n = poll(fds, 2, -1);
+  if(n != 1 || fds[0].revents != 0 || fds[1].revents != POLLIN){
+    printf(1, "poll: got %d, revents %d %d\n", n, fds[0].revents,
+           fds[1].revents);
+    exit();
+  }
+  wait();
+  close(a[1]);
+  if(poll(fds, 1, -1) != 1 || fds[0].revents != POLLHUP){
+    printf(1, "poll: no POLLHUP\n");
+    exit();
+  }
+  // a negative fd switches its entry off
+  fds[0].fd = -1;
+  if(poll(fds, 1, 0) != 0 || fds[0].revents != 0){
+    printf(1, "poll: negative fd not ignored\n");
+    exit();
+  }
+  close(a[0]);
+  close(b[0]);
+  close(b[1]);
+  printf(1, "poll ok\n");
+}
+
+// Read an empty O_NONBLOCK pipe and fill one up.
+void
+nonblocktest(void)
+{
+  int fds[2], n, size;
+
+  printf(1, "nonblock test\n");
+  if(pipe2(fds, O_NONBLOCK) != 0){
+    printf(1, "pipe2() failed\n");
+    exit();
+  }
+  if(read(fds[0], buf, 1) != EAGAIN){
+    printf(1, "nonblock: read of empty pipe didn't fail\n");
+    exit();
+  }
+  size = fcntl(fds[1], F_GETPIPE_SZ, 0);
+  while(write(fds[1], buf, sizeof(buf)) == sizeof(buf))
+    ;
+  if(write(fds[1], buf, 1) != EAGAIN){
+    printf(1, "nonblock: write to full pipe didn't fail\n");
+    exit();
+  }
+  for(n = 0; (size -= n) > 0; )
+    n = read(fds[0], buf, sizeof(buf));
+  if(size != 0 || read(fds[0], buf, 1) != EAGAIN){
+    printf(1, "nonblock: pipe held the wrong amount\n");
+    exit();
+  }
+  if(fcntl(fds[0], F_GETFL, 0) != (O_RDONLY|O_NONBLOCK) ||
+     fcntl(fds[0], F_SETFL, 0) != 0 ||
+     fcntl(fds[0], F_GETFL, 0) != O_RDONLY){
+    printf(1, "nonblock: F_GETFL/F_SETFL failed\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  printf(1, "nonblock ok\n");
+}
+
+// Check futex()'s error cases, and an uncontended lock.
+void
+futextest(void)
+{
+  int w, l;
+
+  printf(1, "futex test\n");
+  w = 1;
+  if(futex(&w, FUTEX_WAIT, 0) != -1){
+    printf(1, "futex: waited on a changed word\n");
+    exit();
+  }
+  if(futex(&w, FUTEX_WAKE, 1) != 0 ||
+     futex((int*)((char*)&w + 1), FUTEX_WAKE, 1) != -1){
+    printf(1, "futex: bad wake\n");
+    exit();
+  }
+  l = 0;
+  lock_acquire(&l);
+  if(l != 1){
+    printf(1, "futex: lock not held\n");
+    exit();
+  }
+  lock_release(&l);
+  if(l != 0){
+    printf(1, "futex: lock not released\n");
+    exit();
+  }
+  printf(1, "futex ok\n");
+}
+
+#define NTHREAD 4
+
+void
+threadadd(void *lock, void *count)
+{
+  int i;
+
+  for(i = 0; i < 1000; i++){
+    lock_acquire(lock);
+    (*(int*)count)++;
+    lock_release(lock);
+  }
+  exit();
+}
+
+// open a file for the thread that created this one.
+void
+threadopen(void *name, void *fd)
+{
+  *(int*)fd = open(name, O_CREATE|O_RDWR);
+  exit();
+}
+
+// try to shrink the memory this thread shares with its creator.
+void
+threadshrink(void *r, void *unused)
+{
+  *(int*)r = (int)sbrk(-4096);
+  exit();
+}
+
+void
+threadtest(void)
+{
+  int i, l, count, fd, r;
+
+  printf(1, "thread test\n");
+  l = count = 0;
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_create(threadadd, &l, &count) < 0){
+      printf(1, "thread_create failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_join() < 0){
+      printf(1, "thread_join failed\n");
+      exit();
+    }
+  }
+  if(thread_join() != -1 || wait() != -1){
+    printf(1, "thread: extra children\n");
+    exit();
+  }
+  if(count != NTHREAD*1000){
+    printf(1, "thread: count %d, want %d\n", count, NTHREAD*1000);
+    exit();
+  }
+
+  // threads share the file table
+  fd = -1;
+  if(thread_create(threadopen, "threadfd", &fd) < 0 || thread_join() < 0){
+    printf(1, "thread: threadopen failed\n");
+    exit();
+  }
+  if(fd < 0 || write(fd, "x", 1) != 1){
+    printf(1, "thread: fd %d from a thread not usable\n", fd);
+    exit();
+  }
+  close(fd);
+  unlink("threadfd");
+
+  // no thread may shrink memory that another is using
+  r = 0;
+  if(thread_create(threadshrink, &r, 0) < 0 || thread_join() < 0){
+    printf(1, "thread: threadshrink failed\n");
+    exit();
+  }
+  if(r != -1){
+    printf(1, "thread: sbrk shrank shared memory\n");
+    exit();
+  }
+  printf(1, "thread ok\n");
+}
+
+#define NSYSCALL 100000
+
+// make argument-less system call num the old way,
+// through int $T_SYSCALL.
+int
+intsyscall(int num)
+{
+  int r;
+
+  asm volatile("int %1" : "=a" (r) : "i" (T_SYSCALL), "0" (num));
+  return r;
+}
+
+// time a null system call through SYSENTER and through int.
+void
+syscallbench(void)
+{
+  int i, pid, t0, t1;
+
+  printf(1, "syscall bench\n");
+  pid = getpid();
+  if(intsyscall(SYS_getpid) != pid){
+    printf(1, "syscall: getpid %d, int getpid %d\n", pid,
+           intsyscall(SYS_getpid));
+    exit();
+  }
+  t0 = uptime();
+  for(i = 0; i < NSYSCALL; i++)
+    getpid();
+  t0 = uptime() - t0;
+  t1 = uptime();
+  for(i = 0; i < NSYSCALL; i++)
+    intsyscall(SYS_getpid);
+  t1 = uptime() - t1;
+  printf(1, "syscall: %d getpids in %d ticks by sysenter, %d by int\n",
+         NSYSCALL, t0, t1);
+}
+
+// does the vDSO page agree with the kernel, and is it read-only?
+void
+vdsotest(void)
+{
+  volatile struct vdso *v = (struct vdso*)VDSO;
+  int i, t, ppid, pid;
+  uint b;
+
+  printf(1, "vdso test\n");
+  t = intsyscall(SYS_uptime);
+  i = uptime();
+  if(i < t || i > t + 1){
+    printf(1, "vdso: uptime %d, sys_uptime %d\n", i, t);
+    exit();
+  }
+  for(i = 0; i < NCPU; i++){
+    // the kernel counts ticks before busy, so read busy first
+    b = v->cpu[i].busy;
+    if(b > v->cpu[i].ticks){
+      printf(1, "vdso: cpu%d busy %d of %d ticks\n", i,
+             b, v->cpu[i].ticks);
+      exit();
+    }
+  }
+
+  ppid = getpid();
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    v->ticks = 0;
+    printf(1, "oops could write vdso\n");
+    kill(ppid);
+    exit();
+  }
+  wait();
+  printf(1, "vdso ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -931,6 +1611,145 @@ bigdir(void)
   printf(1, "bigdir ok\n");
 }
 
+// create, stat and unlink many files in one directory,
+// which grows it well past one block, and time each step.
+void
+dirbench(void)
+{
+  enum { NDB = 1000 };
+  int i, fd, t0;
+  char name[8];
+  struct stat st;
+
+  printf(1, "dirbench test\n");
+
+  if(mkdir("db") != 0){
+    printf(1, "dirbench: mkdir db failed\n");
+    exit();
+  }
+  name[0] = 'd';
+  name[1] = 'b';
+  name[2] = '/';
+  name[7] = '\0';
+
+  t0 = uptime();
+  for(i = 0; i < NDB; i++){
+    name[3] = '0' + i/1000;
+    name[4] = '0' + i/100%10;
+    name[5] = '0' + i/10%10;
+    name[6] = '0' + i%10;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf(1, "dirbench: create %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+  printf(1, "dirbench: %d creates in %d ticks\n", NDB, uptime() - t0);
+
+  t0 = uptime();
+  for(i = 0; i < NDB; i++){
+    name[3] = '0' + i/1000;
+    name[4] = '0' + i/100%10;
+    name[5] = '0' + i/10%10;
+    name[6] = '0' + i%10;
+    if(stat(name, &st) < 0 || st.type != T_FILE){
+      printf(1, "dirbench: stat %s failed\n", name);
+      exit();
+    }
+  }
+  printf(1, "dirbench: %d stats in %d ticks\n", NDB, uptime() - t0);
+
+  t0 = uptime();
+  for(i = 0; i < NDB; i++){
+    name[3] = '0' + i/1000;
+    name[4] = '0' + i/100%10;
+    name[5] = '0' + i/10%10;
+    name[6] = '0' + i%10;
+    if(unlink(name) < 0){
+      printf(1, "dirbench: unlink %s failed\n", name);
+      exit();
+    }
+  }
+  printf(1, "dirbench: %d unlinks in %d ticks\n", NDB, uptime() - t0);
+
+  if(unlink("db") != 0){
+    printf(1, "dirbench: unlink db failed\n");
+    exit();
+  }
+  printf(1, "dirbench ok\n");
+}
+
+// link one file into a directory until its hash index can't
+// grow, and check that the next entry fails with ENOSPC.
+void
+dirfull(void)
+{
+  enum { NMAX = NDIRSLOT*DPB };
+  int i, n, r, fd;
+  char name[9];
+
+  printf(1, "dirfull test\n");
+
+  if(mkdir("df") != 0){
+    printf(1, "dirfull: mkdir df failed\n");
+    exit();
+  }
+  if((fd = open("df/f", O_CREATE|O_RDWR)) < 0){
+    printf(1, "dirfull: create df/f failed\n");
+    exit();
+  }
+  close(fd);
+  name[0] = 'd';
+  name[1] = 'f';
+  name[2] = '/';
+  name[8] = '\0';
+
+  r = 0;
+  for(n = 0; n < NMAX; n++){
+    name[3] = 'x';
+    name[4] = '0' + n/1000;
+    name[5] = '0' + n/100%10;
+    name[6] = '0' + n/10%10;
+    name[7] = '0' + n%10;
+    if((r = link("df/f", name)) < 0)
+      break;
+  }
+  if(r != ENOSPC){
+    printf(1, "dirfull: link %s returned %d, not ENOSPC\n", name, r);
+    exit();
+  }
+  // With NDIRSLOT buckets of DPB entries, no bucket should
+  // fill up before about 1000 names.
+  if(n < 1000){
+    printf(1, "dirfull: full after only %d entries\n", n);
+    exit();
+  }
+  if((r = open("df/new", O_CREATE|O_RDWR)) != ENOSPC){
+    printf(1, "dirfull: create in full directory returned %d\n", r);
+    exit();
+  }
+  if((r = mkdir("df/dd")) != ENOSPC){
+    printf(1, "dirfull: mkdir in full directory returned %d\n", r);
+    exit();
+  }
+
+  for(i = 0; i < n; i++){
+    name[4] = '0' + i/1000;
+    name[5] = '0' + i/100%10;
+    name[6] = '0' + i/10%10;
+    name[7] = '0' + i%10;
+    if(unlink(name) != 0){
+      printf(1, "dirfull: unlink %s failed\n", name);
+      exit();
+    }
+  }
+  if(unlink("df/f") != 0 || unlink("df") != 0){
+    printf(1, "dirfull: cleanup failed\n");
+    exit();
+  }
+  printf(1, "dirfull ok: %d entries\n", n);
+}
+
 void
 subdir(void)
 {
@@ -1773,6 +2592,10 @@ main(int argc, char *argv[])
   opentest();
   writetest();
   writetest1();
+  hugefile();  // these three need more disk
+  nearfull();  // than kernelmemfs has
+  copybench();
+  iovtest();
   createtest();
 
   openiputtest();
@@ -1781,6 +2604,14 @@ main(int argc, char *argv[])
 
   mem();
   pipe1();
+  pipebw();
+  splicetest();
+  polltest();
+  nonblocktest();
+  futextest();
+  threadtest();
+  syscallbench();
+  vdsotest();
   preempt();
   exitwait();
 
@@ -1794,6 +2625,8 @@ main(int argc, char *argv[])
   iref();
   forktest();
   bigdir(); // slow
+  dirbench();
+  dirfull(); // slow
 
   uio();
 
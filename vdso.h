@@ -0,0 +1,14 @@
+// The vDSO page: mapped read-only at VDSO in every process
+// and kept up to date by the kernel, so that user code can
+// read it without a system call.
+
+// Timer interrupts seen by one CPU.
+struct vdsocpu {
+  uint ticks;
+  uint busy;  // of ticks, those that found a process running
+};
+
+struct vdso {
+  uint ticks;                // what uptime() returns
+  struct vdsocpu cpu[NCPU];  // unused CPUs stay at 0
+};
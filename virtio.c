@@ -0,0 +1,236 @@
+// Driver for a legacy virtio-blk PCI disk (QEMU "virtio-blk-pci").
+//
+// When present and there is no IDE disk 1, the virtio disk
+// stands in for device 1 (the file system disk): iderw() hands
+// such requests to virtiorw().
+//
+// Unlike the IDE driver, which has one request in flight at a
+// time, every sleeping iderw() caller can have its request
+// queued in the ring at once, and virtiointr() completes all
+// finished requests per interrupt.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "virtio.h"
+
+#define SECTOR_SIZE 512
+
+// Byte offsets of the parts of a legacy virtqueue of n entries.
+#define QALIGN(x)      (((x) + PGSIZE-1) & ~(PGSIZE-1))
+#define AVAILOFF(n)    (16*(n))
+#define USEDOFF(n)     QALIGN(16*(n) + 2*(3+(n)))
+#define QBYTES(n)      (USEDOFF(n) + QALIGN(2*3 + 8*(n)))
+
+// The queue must be physically contiguous, so it lives in the
+// kernel's data segment rather than in kalloc() pages.
+static char vqmem[QBYTES(VIRTIO_MAXQ)] __attribute__((aligned(PGSIZE)));
+
+static struct {
+  struct spinlock lock;
+  uint iobase;
+  uint nsect;                   // capacity in sectors
+  uint num;                     // queue size chosen by the device
+  struct vring_desc *desc;
+  struct vring_avail *avail;
+  struct vring_used *used;
+  ushort usedidx;               // next used entry to look at
+  int nfree;
+  char free[VIRTIO_MAXQ];       // is descriptor i free?
+
+  // Per request, indexed by the head descriptor.
+  struct {
+    struct buf *b;
+    uchar status;
+  } info[VIRTIO_MAXQ];
+  struct virtio_blk_req ops[VIRTIO_MAXQ];
+} disk;
+
+int virtioirq;                  // IRQ line, 0 if there is no disk
+
+int
+virtioinit(void)
+{
+  struct pcidev d;
+  uint i, num;
+
+  if(pcifinddev(VIRTIO_VENDOR, VIRTIO_DEV_BLK, &d) < 0)
+    return -1;
+  if((d.bar[0] & PCI_BAR_IO) == 0)
+    return -1;
+  pciconfwrite(&d, PCI_COMMAND,
+               pciconfread(&d, PCI_COMMAND) | PCI_CMD_IO | PCI_CMD_MASTER);
+
+  initlock(&disk.lock, "virtio");
+  disk.iobase = d.bar[0] & ~3;
+
+  outb(disk.iobase+VIRTIO_STATUS, 0);  // reset
+  outb(disk.iobase+VIRTIO_STATUS, VIRTIO_ST_ACK);
+  outb(disk.iobase+VIRTIO_STATUS, VIRTIO_ST_ACK|VIRTIO_ST_DRIVER);
+  outl(disk.iobase+VIRTIO_GUESTFEAT, 0);  // plain reads and writes only
+
+  outw(disk.iobase+VIRTIO_QSEL, 0);
+  num = inw(disk.iobase+VIRTIO_QSIZE);
+  if(num == 0 || num > VIRTIO_MAXQ){
+    outb(disk.iobase+VIRTIO_STATUS, VIRTIO_ST_FAILED);
+    cprintf("virtio: unsupported queue size %d\n", num);
+    return -1;
+  }
+  disk.num = num;
+  memset(vqmem, 0, sizeof(vqmem));
+  disk.desc = (struct vring_desc*)vqmem;
+  disk.avail = (struct vring_avail*)(vqmem + AVAILOFF(num));
+  disk.used = (struct vring_used*)(vqmem + USEDOFF(num));
+  for(i = 0; i < num; i++)
+    disk.free[i] = 1;
+  disk.nfree = num;
+  outl(disk.iobase+VIRTIO_QPFN, V2P(vqmem) >> VIRTIO_PGSHIFT);
+
+  disk.nsect = inl(disk.iobase+VIRTIO_BLK_CAPACITY);
+  outb(disk.iobase+VIRTIO_STATUS,
+       VIRTIO_ST_ACK|VIRTIO_ST_DRIVER|VIRTIO_ST_DRIVER_OK);
+
+  virtioirq = d.irq;
+  ioapicenable(virtioirq, ncpu - 1);
+  cprintf("virtio: disk %d sectors, queue %d, irq %d\n",
+          disk.nsect, num, virtioirq);
+  return 0;
+}
+
+// Allocate a descriptor.  Caller must hold disk.lock.
+static int
+alloc_desc(void)
+{
+  int i;
+
+  for(i = 0; i < disk.num; i++){
+    if(disk.free[i]){
+      disk.free[i] = 0;
+      disk.nfree--;
+      return i;
+    }
+  }
+  panic("virtio: alloc_desc");
+}
+
+// Free a chain of descriptors.  Caller must hold disk.lock.
+static void
+free_chain(int i)
+{
+  int flags;
+
+  for(;;){
+    flags = disk.desc[i].flags;
+    disk.free[i] = 1;
+    disk.nfree++;
+    if((flags & VRING_DESC_F_NEXT) == 0)
+      break;
+    i = disk.desc[i].next;
+  }
+  wakeup(&disk.free);
+}
+
+// Sync buf with disk, with the same contract as iderw().
+void
+virtiorw(struct buf *b)
+{
+  int idx[3], i;
+  uint sector;
+
+  if(!holdingsleep(&b->lock))
+    panic("virtiorw: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("virtiorw: nothing to do");
+  sector = b->blockno * (BSIZE / SECTOR_SIZE);
+  if(sector + BSIZE/SECTOR_SIZE > disk.nsect)
+    panic("virtiorw: block out of range");
+
+  acquire(&disk.lock);
+
+  // A request is three descriptors: header, data and status.
+  while(disk.nfree < 3)
+    sleep(&disk.free, &disk.lock);
+  for(i = 0; i < 3; i++)
+    idx[i] = alloc_desc();
+
+  disk.ops[idx[0]].type = (b->flags & B_DIRTY) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  disk.ops[idx[0]].reserved = 0;
+  disk.ops[idx[0]].sector = sector;
+  disk.ops[idx[0]].sectorhi = 0;
+
+  disk.desc[idx[0]].addr = V2P(&disk.ops[idx[0]]);
+  disk.desc[idx[0]].addrhi = 0;
+  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  disk.desc[idx[0]].next = idx[1];
+
+  disk.desc[idx[1]].addr = V2P(b->data);
+  disk.desc[idx[1]].addrhi = 0;
+  disk.desc[idx[1]].len = BSIZE;
+  disk.desc[idx[1]].flags = VRING_DESC_F_NEXT;
+  if((b->flags & B_DIRTY) == 0)
+    disk.desc[idx[1]].flags |= VRING_DESC_F_WRITE;  // device writes b->data
+  disk.desc[idx[1]].next = idx[2];
+
+  disk.info[idx[0]].status = 0xff;  // device writes 0 on success
+  disk.desc[idx[2]].addr = V2P(&disk.info[idx[0]].status);
+  disk.desc[idx[2]].addrhi = 0;
+  disk.desc[idx[2]].len = 1;
+  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE;
+  disk.desc[idx[2]].next = 0;
+
+  disk.info[idx[0]].b = b;
+
+  // Publish the chain, then the new index, then tell the device.
+  disk.avail->ring[disk.avail->idx % disk.num] = idx[0];
+  __sync_synchronize();
+  disk.avail->idx++;
+  __sync_synchronize();
+  outw(disk.iobase+VIRTIO_QNOTIFY, 0);
+
+  // Wait for virtiointr() to say the request has finished.
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &disk.lock);
+
+  release(&disk.lock);
+}
+
+// Interrupt handler: complete every request the device has used.
+void
+virtiointr(void)
+{
+  struct buf *b;
+  int id;
+
+  acquire(&disk.lock);
+
+  inb(disk.iobase+VIRTIO_ISR);  // acknowledge; deasserts the line
+
+  while(disk.usedidx != disk.used->idx){
+    __sync_synchronize();
+    id = disk.used->ring[disk.usedidx % disk.num].id;
+    if(disk.info[id].status != 0)
+      panic("virtiointr: request failed");
+
+    b = disk.info[id].b;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+
+    disk.info[id].b = 0;
+    free_chain(id);
+    disk.usedidx++;
+  }
+
+  release(&disk.lock);
+}
@@ -0,0 +1,65 @@
+// Legacy (virtio 0.9.5) PCI interface to a virtio block device.
+// See "Virtio PCI Card Specification v0.9.5", Rusty Russell.
+
+#define VIRTIO_VENDOR       0x1AF4
+#define VIRTIO_DEV_BLK      0x1001  // transitional block device
+
+// Registers in the I/O space of BAR0.
+#define VIRTIO_HOSTFEAT     0x00    // device features (32)
+#define VIRTIO_GUESTFEAT    0x04    // driver features (32)
+#define VIRTIO_QPFN         0x08    // queue physical page number (32)
+#define VIRTIO_QSIZE        0x0C    // queue size (16)
+#define VIRTIO_QSEL         0x0E    // queue select (16)
+#define VIRTIO_QNOTIFY      0x10    // queue notify (16)
+#define VIRTIO_STATUS       0x12    // device status (8)
+#define VIRTIO_ISR          0x13    // interrupt status, read clears (8)
+#define VIRTIO_BLK_CAPACITY 0x14    // capacity in 512-byte sectors (64)
+
+// Device status bits.
+#define VIRTIO_ST_ACK       1
+#define VIRTIO_ST_DRIVER    2
+#define VIRTIO_ST_DRIVER_OK 4
+#define VIRTIO_ST_FAILED    128
+
+#define VIRTIO_PGSHIFT      12      // queue addresses are in 4K pages
+#define VIRTIO_MAXQ         256     // largest queue this driver handles
+
+// Ring descriptor.
+struct vring_desc {
+  uint addr;            // guest physical address, low 32 bits
+  uint addrhi;          // high 32 bits (always 0 here)
+  uint len;
+  ushort flags;
+  ushort next;
+};
+#define VRING_DESC_F_NEXT   1       // chained with next
+#define VRING_DESC_F_WRITE  2       // device writes (vs reads)
+
+// Ring of descriptor chains made available to the device.
+struct vring_avail {
+  ushort flags;
+  ushort idx;           // where the driver puts the next entry
+  ushort ring[];
+};
+
+struct vring_used_elem {
+  uint id;              // head of the completed descriptor chain
+  uint len;
+};
+
+// Ring of descriptor chains the device has finished with.
+struct vring_used {
+  ushort flags;
+  ushort idx;           // where the device puts the next entry
+  struct vring_used_elem ring[];
+};
+
+// Block request header, the first descriptor of every request.
+struct virtio_blk_req {
+  uint type;
+  uint reserved;
+  uint sector;          // low 32 bits
+  uint sectorhi;
+};
+#define VIRTIO_BLK_T_IN     0       // read the disk
+#define VIRTIO_BLK_T_OUT    1       // write the disk
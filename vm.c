@@ -6,8 +6,13 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "vdso.h"
 
 extern char data[];  // defined by kernel.ld
+extern void sysenter(void);  // in trapasm.S
+
+static char vdsopage[PGSIZE] __attribute__((aligned(PGSIZE)));
+struct vdso *vdso = (struct vdso*)vdsopage;
 pde_t *kpgdir;  // for use in scheduler()
 
 // Set up CPU's kernel segment descriptors.
@@ -27,6 +32,14 @@ seginit(void)
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
   lgdt(c->gdt, sizeof(c->gdt));
+
+  // SYSENTER loads %cs and %ss from SEG_KCODE and SEG_KDATA,
+  // and SYSEXIT %cs and %ss from SEG_UCODE and SEG_UDATA, so
+  // the GDT order above is the one the instructions require.
+  // The entry %esp is the process's kernel stack; switchuvm
+  // sets it.
+  wrmsr(MSR_SYSENTER_CS, SEG_KCODE<<3);
+  wrmsr(MSR_SYSENTER_EIP, (uint)sysenter);
 }
 
 // Return the address of the PTE in page table pgdir
@@ -87,8 +100,9 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //
 // setupkvm() and exec() set up every page table like this:
 //
-//   0..KERNBASE: user memory (text+data+stack+heap), mapped to
+//   0..VDSO: user memory (text+data+stack+heap), mapped to
 //                phys memory allocated by the kernel
+//   VDSO..KERNBASE: the vDSO page, shared read-only by all
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
@@ -169,6 +183,7 @@ switchuvm(struct proc *p)
   mycpu()->gdt[SEG_TSS].s = 0;
   mycpu()->ts.ss0 = SEG_KDATA << 3;
   mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
+  wrmsr(MSR_SYSENTER_ESP, (uint)p->kstack + KSTACKSIZE);
   // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
@@ -177,6 +192,13 @@ switchuvm(struct proc *p)
   popcli();
 }
 
+// Map the vDSO page read-only at VDSO in pgdir.
+int
+mapvdso(pde_t *pgdir)
+{
+  return mappages(pgdir, (char*)VDSO, PGSIZE, V2P(vdsopage), PTE_U);
+}
+
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void
@@ -224,7 +246,7 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz > VDSO)
     return 0;
   if(newsz < oldsz)
     return oldsz;
@@ -287,7 +309,7 @@ freevm(pde_t *pgdir)
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
-  deallocuvm(pgdir, KERNBASE, 0);
+  deallocuvm(pgdir, VDSO, 0);  // the vDSO page isn't ours to free
   for(i = 0; i < NPDENTRIES; i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
@@ -322,6 +344,8 @@ copyuvm(pde_t *pgdir, uint sz)
 
   if((d = setupkvm()) == 0)
     return 0;
+  if(mapvdso(d) < 0)
+    goto bad;
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
       panic("copyuvm: pte should exist");